@@ -0,0 +1,133 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cassert>
+#include <cstddef>
+#include <xmmintrin.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/** A region of memory for the source and destination buffers, allocated once and never freed piece by piece.
+  * On Linux it is mapped with 2 MB hugepages if the system has them reserved (/proc/sys/vm/nr_hugepages);
+  * otherwise transparent hugepages are requested with madvise. Either way the buffers need few TLB entries.
+  * The channel buffers can be skewed: with power-of-two sizes, the same position in all channels maps to the
+  * same cache set (and the same 4K offset, which causes false store-to-load dependencies), so every channel
+  * is shifted by a few cache lines relative to the previous one.
+  * The arena can be bound to a NUMA node (mbind with MPOL_BIND, called directly, so libnuma is not required).
+  * Failures are reported, not asserted: valid () is false if the memory could not be mapped, bound () is false
+  * if it could not be bound to the node, and allocate returns NULL if the buffer does not fit.
+  */
+class Arena
+{
+    static const size_t CACHE_LINE = 64;
+    static const size_t HUGE_PAGE = 2 * 1024 * 1024;
+    static const int MPOL_BIND_POLICY = 2;  // MPOL_BIND from numaif.h
+
+    unsigned char * base;
+    size_t size;
+    size_t used;
+    bool huge;
+    bool on_node;
+
+public:
+    /** Creates an arena; check valid () afterwards
+      * @param size  total number of bytes; rounded up to a multiple of the hugepage size
+      * @param node  NUMA node to allocate the memory on, or -1 to use the default policy (first touch)
+      */
+    Arena (size_t size, int node = -1)
+        : size ((size + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE), used (0), huge (false), on_node (node < 0)
+    {
+#ifdef __linux__
+        void * p = mmap (NULL, this->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            huge = true;
+        } else {
+            p = mmap (NULL, this->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) {
+                base = NULL;
+                return;
+            }
+            madvise (p, this->size, MADV_HUGEPAGE);
+        }
+        if (node >= 0 && node < 64) {
+            unsigned long mask = 1UL << node;
+            on_node = syscall (__NR_mbind, p, this->size, MPOL_BIND_POLICY, &mask, sizeof (mask) * 8 + 1, 0) == 0;
+        }
+        base = (unsigned char *) p;
+#else
+        base = (unsigned char *) _mm_malloc (this->size, HUGE_PAGE);
+#endif
+    }
+
+    ~Arena ()
+    {
+        if (base == NULL) return;
+#ifdef __linux__
+        munmap (base, size);
+#else
+        _mm_free (base);
+#endif
+    }
+
+    Arena (const Arena &) = delete;
+    Arena & operator = (const Arena &) = delete;
+
+    /** @return true if the memory of the arena has been allocated */
+    bool valid () const
+    {
+        return base != NULL;
+    }
+
+    /** @return false if the arena was requested on a NUMA node, but could not be bound to it
+      *         (mbind failed, or the node number does not fit the mask); the memory then follows the default policy
+      */
+    bool bound () const
+    {
+        return on_node;
+    }
+
+    /** @return true if the arena is mapped with reserved hugepages (not just advised to use transparent ones) */
+    bool hugepages () const
+    {
+        return huge;
+    }
+
+    /** Allocates a buffer
+      * @param length  number of bytes
+      * @param align   alignment, a power of two, at least 64
+      * @return the buffer, or NULL if the arena is not valid or the buffer does not fit into the rest of it
+      */
+    unsigned char * allocate (size_t length, size_t align = CACHE_LINE)
+    {
+        assert ((align & (align - 1)) == 0 && align >= CACHE_LINE);
+        size_t pos = (used + align - 1) & ~(align - 1);
+        if (base == NULL || pos > size || length > size - pos) return NULL;
+        used = pos + length;
+        return base + pos;
+    }
+
+    /** Allocates buffers for a set of channels, one after another
+      * @param dst       array of channel pointers to fill
+      * @param channels  number of channels
+      * @param length    size of each channel buffer
+      * @param skew      number of bytes added between two channel buffers, a multiple of 64
+      * @return false if the buffers do not fit (dst is not changed then)
+      */
+    bool allocate_channels (unsigned char ** dst, size_t channels, size_t length, size_t skew)
+    {
+        assert (skew % CACHE_LINE == 0);
+        size_t stride = (length + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE + skew;
+        unsigned char * p = allocate (stride * channels, 4096);
+        if (p == NULL) return false;
+        for (size_t i = 0; i < channels; i++) {
+            dst [i] = p + i * stride;
+        }
+        return true;
+    }
+};
+
+#endif
@@ -11,18 +11,70 @@
      Revision 11: Added Read4_Write32_AVX
      Revision 12: Improved Read4_Write32_AVX
      Revision 13: Added Read8_Write32_AVX (normal and unrolled versions)
+     Revision 14: Added Read16_Write16_SSE_Activity (idle timeslot detection and energy estimate)
+     Revision 15: Added Goertzel and Goertzel_AVX (DTMF detection on demultiplexed timeslots)
+     Revision 16: Added output into per-channel ring buffers (demux_to_rings)
+     Revision 17: Added output into a shared memory plane for other processes (demux_to_plane)
+     Revision 18: Added Stream_Demux and the capture file demultiplexer ("demux" command)
+     Revision 19: Added the pipelined capture file demultiplexer ("pipeline" command)
+     Revision 20: Added Incremental_Demux (low latency demultiplexing of a few frames at a time)
+     Revision 21: Added Batch_Demux with statically bound kernels (Static_Batch); Stream_Demux uses it
+     Revision 22: Unrolled versions are generated from register blocks by templates (Unrolled) instead of macros;
+                  added Read16_Write8_SSE2_Unroll and Read32_Write32_AVX2_Unroll
+     Revision 23: Added hardware performance counters around measurements ("counters" command)
+     Revision 24: Added measurements with working sets from L1 to DRAM ("hierarchy" command)
+     Revision 25: Added Arena (hugepages, skewed channel buffers) and its measurement ("arena" command)
+     Revision 26: Added demultiplexing of several links by workers pinned to NUMA nodes ("numa" command)
+     Revision 27: Added parallel_demux (one large buffer on several threads) and its measurement ("parallel" command)
+     Revision 28: Added In_Place_Demux (transposition of a block within the source buffer)
+     Revision 29: Added Swept and Tiled drivers for long blocks of any length ("tiled" command)
+     Revision 30: Added Read16_Write16_SSE2_Unroll and Read32_Write32_AVX2_Unpack_Unroll (unpack cascade transposition)
+     Revision 31: Added Gather_Select (gathers of selected timeslots) and Select_Demux (gathers or full transposition)
+     Revision 32: Added Read8_Write8 (8x8 transposition in 64-bit registers, normal and unrolled versions)
+     Revision 33: Added Read16_Write16_Vec_Unroll, Read32_Write32_Vec_Unroll and Read32_Write32_Vec512_Unroll
+                  (transpositions with compiler vector extensions, vec.h)
+     Revision 34: Added demultiplexing of bit-reversed timeslots (Read16_Write16_SSE_Reverse_Unroll,
+                  Read32_Write32_AVX2_Reverse_Unroll) and A-law expansion into linear samples (Read32_Write32_AVX2_Linear)
+     Revision 35: Added per-call latency percentiles ("latency" command)
+     Revision 36: Added saving of results as a baseline and comparison with it ("baseline" and "compare" commands)
+     Revision 37: Added measurements of other geometries: 24 and 32 timeslots, blocks of any size ("sweep" command)
+     Revision 38: Added monitoring of frame alignment (FAS) to Stream_Demux, with realignment after slips
   */
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cmath>
 #include <cstdlib>
 #include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
 #include <typeinfo>
+#include <vector>
 #include <stdio.h>
+#include <cpuid.h>
 
 #include "timer.h"
 #include "mymacros.h"
 #include "sse.h"
+#include "vec.h"
+#include "ring.h"
+#include "queue.h"
+#include "arena.h"
+#include "histogram.h"
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "shm_plane.h"
+#include "perf_counters.h"
+#include "numa.h"
+#endif
 
 typedef unsigned char byte;
 
@@ -33,6 +85,15 @@ static const unsigned ITERATIONS = 1000000;
 
 using namespace std;
 
+/** @return the time stamp counter, read after all earlier instructions have completed and before later ones start */
+inline uint64_t timestamp ()
+{
+    _mm_lfence ();
+    uint64_t t = __rdtsc ();
+    _mm_lfence ();
+    return t;
+}
+
 class Demux
 {
 public:
@@ -169,51 +230,56 @@ public:
     }
 };
 
-class Read4_Write4_Unroll : public Demux
+/** Transposes an 8x8 byte matrix held in eight 64-bit words (byte j of x [i] is the element (i, j)) without SIMD:
+  * three rounds swap 32-bit, 16-bit and 8-bit sub-matrices between words with masks and shifts.
+  */
+ALWAYS_INLINE void transpose_8x8 (uint64_t (&x) [8])
+{
+    unroll<4> ([&] (auto i) ALWAYS_INLINE_LAMBDA {
+        uint64_t a = x [i], b = x [i + 4];
+        x [i]     = (a & 0x00000000FFFFFFFFULL) | (b << 32);
+        x [i + 4] = (a >> 32) | (b & 0xFFFFFFFF00000000ULL);
+    });
+    unroll<4> ([&] (auto k) ALWAYS_INLINE_LAMBDA {
+        const size_t i = k / 2 * 4 + k % 2;
+        uint64_t a = x [i], b = x [i + 2];
+        x [i]     = (a & 0x0000FFFF0000FFFFULL) | ((b & 0x0000FFFF0000FFFFULL) << 16);
+        x [i + 2] = ((a >> 16) & 0x0000FFFF0000FFFFULL) | (b & 0xFFFF0000FFFF0000ULL);
+    });
+    unroll<4> ([&] (auto k) ALWAYS_INLINE_LAMBDA {
+        const size_t i = k * 2;
+        uint64_t a = x [i], b = x [i + 1];
+        x [i]     = (a & 0x00FF00FF00FF00FFULL) | ((b & 0x00FF00FF00FF00FFULL) << 8);
+        x [i + 1] = ((a >> 8) & 0x00FF00FF00FF00FFULL) | (b & 0xFF00FF00FF00FF00ULL);
+    });
+}
+
+class Read8_Write8 : public Demux
 {
 public:
     void demux (const byte * src, size_t src_length, byte ** dst) const
     {
         assert (src_length == NUM_TIMESLOTS * DST_SIZE);
-        assert (DST_SIZE == 64);
-        assert (NUM_TIMESLOTS % 4 == 0);
+        assert (DST_SIZE % 8 == 0);
+        assert (NUM_TIMESLOTS % 8 == 0);
 
-        for (size_t dst_num = 0; dst_num < NUM_TIMESLOTS; dst_num += 4) {
-            byte * d0 = dst [dst_num + 0];
-            byte * d1 = dst [dst_num + 1];
-            byte * d2 = dst [dst_num + 2];
-            byte * d3 = dst [dst_num + 3];
-#define MOVE16(dst_pos) do {\
-                uint32_t w0 = * (uint32_t*) &src [(dst_pos + 0) * NUM_TIMESLOTS + dst_num];\
-                uint32_t w1 = * (uint32_t*) &src [(dst_pos + 1) * NUM_TIMESLOTS + dst_num];\
-                uint32_t w2 = * (uint32_t*) &src [(dst_pos + 2) * NUM_TIMESLOTS + dst_num];\
-                uint32_t w3 = * (uint32_t*) &src [(dst_pos + 3) * NUM_TIMESLOTS + dst_num];\
-                * (uint32_t*) &d0 [dst_pos] = make_32 (byte0 (w0), byte0 (w1), byte0 (w2), byte0 (w3));\
-                * (uint32_t*) &d1 [dst_pos] = make_32 (byte1 (w0), byte1 (w1), byte1 (w2), byte1 (w3));\
-                * (uint32_t*) &d2 [dst_pos] = make_32 (byte2 (w0), byte2 (w1), byte2 (w2), byte2 (w3));\
-                * (uint32_t*) &d3 [dst_pos] = make_32 (byte3 (w0), byte3 (w1), byte3 (w2), byte3 (w3));\
-            } while (0)
-            MOVE16 (0);
-            MOVE16 (4);
-            MOVE16 (8);
-            MOVE16 (12);
-            MOVE16 (16);
-            MOVE16 (20);
-            MOVE16 (24);
-            MOVE16 (28);
-            MOVE16 (32);
-            MOVE16 (36);
-            MOVE16 (40);
-            MOVE16 (44);
-            MOVE16 (48);
-            MOVE16 (52);
-            MOVE16 (56);
-            MOVE16 (60);
-#undef MOVE16
+        for (size_t dst_num = 0; dst_num < NUM_TIMESLOTS; dst_num += 8) {
+            for (size_t dst_pos = 0; dst_pos < DST_SIZE; dst_pos += 8) {
+                uint64_t w [8];
+                for (size_t i = 0; i < 8; i++) {
+                    w [i] = * (uint64_t*) &src [(dst_pos + i) * NUM_TIMESLOTS + dst_num];
+                }
+                transpose_8x8 (w);
+                for (size_t i = 0; i < 8; i++) {
+                    * (uint64_t*) &dst [dst_num + i][dst_pos] = w [i];
+                }
+            }
         }
     }
 };
 
+#ifdef __SSE4_1__
+
 class Read4_Write4_SSE : public Demux
 {
 public:
@@ -338,103 +404,6 @@ public:
     }
 };
 
-class Read8_Write16_SSE_Unroll : public Demux
-{
-public:
-    void demux (const byte * src, size_t src_length, byte ** dst) const
-    {
-        assert (src_length == NUM_TIMESLOTS * DST_SIZE);
-        assert (DST_SIZE == 64);
-        assert (NUM_TIMESLOTS % 8 == 0);
-
-        for (size_t dst_num = 0; dst_num < NUM_TIMESLOTS; dst_num += 8) {
-            byte * d0 = dst [dst_num + 0];
-            byte * d1 = dst [dst_num + 1];
-            byte * d2 = dst [dst_num + 2];
-            byte * d3 = dst [dst_num + 3];
-            byte * d4 = dst [dst_num + 4];
-            byte * d5 = dst [dst_num + 5];
-            byte * d6 = dst [dst_num + 6];
-            byte * d7 = dst [dst_num + 7];
-
-#define LOAD32(m0, m1, dst_pos) do {\
-                    __m64 w0 = * (__m64 *) &src [(dst_pos + 0) * NUM_TIMESLOTS + dst_num];\
-                    __m64 w1 = * (__m64 *) &src [(dst_pos + 1) * NUM_TIMESLOTS + dst_num];\
-                    __m64 w2 = * (__m64 *) &src [(dst_pos + 2) * NUM_TIMESLOTS + dst_num];\
-                    __m64 w3 = * (__m64 *) &src [(dst_pos + 3) * NUM_TIMESLOTS + dst_num];\
-                    __m128i x0 = _mm_setr_epi64 (w0, w1);\
-                    __m128i x1 = _mm_setr_epi64 (w2, w3);\
-                    m0 = _128i_shuffle (x0, x1, 0, 2, 0, 2);\
-                    m1 = _128i_shuffle (x0, x1, 1, 3, 1, 3);\
-                    m0 = transpose_4x4 (m0);\
-                    m1 = transpose_4x4 (m1);\
-                } while (0)
-
-#define MOVE128(dst_pos) do {\
-                __m128i a0, a1, a2, a3, b0, b1, b2, b3;\
-                LOAD32 (a0, b0, dst_pos);\
-                LOAD32 (a1, b1, dst_pos + 4);\
-                LOAD32 (a2, b2, dst_pos + 8);\
-                LOAD32 (a3, b3, dst_pos + 12);\
-                transpose_4x4_dwords (a0, a1, a2, a3);\
-                _128i_store (&d0 [dst_pos], a0);\
-                _128i_store (&d1 [dst_pos], a1);\
-                _128i_store (&d2 [dst_pos], a2);\
-                _128i_store (&d3 [dst_pos], a3);\
-                transpose_4x4_dwords (b0, b1, b2, b3);\
-                _128i_store (&d4 [dst_pos], b0);\
-                _128i_store (&d5 [dst_pos], b1);\
-                _128i_store (&d6 [dst_pos], b2);\
-                _128i_store (&d7 [dst_pos], b3);\
-            } while (0)
-
-            MOVE128 (0);
-            MOVE128 (16);
-            MOVE128 (32);
-            MOVE128 (48);
-#undef LOAD32
-#undef MOVE128
-        }
-    }
-};
-
-inline void transpose_16x16 (
-                __m128i&  x0, __m128i&  x1, __m128i&  x2, __m128i&  x3,
-                __m128i&  x4, __m128i&  x5, __m128i&  x6, __m128i&  x7,
-                __m128i&  x8, __m128i&  x9, __m128i& x10, __m128i& x11,
-                __m128i& x12, __m128i& x13, __m128i& x14, __m128i& x15)
-{
-    __m128i m00, m01, m02, m03;
-    __m128i m10, m11, m12, m13;
-    __m128i m20, m21, m22, m23;
-    __m128i m30, m31, m32, m33;
-
-    transpose_4x4_dwords ( x0,  x1,  x2,  x3, m00, m01, m02, m03);
-    transpose_4x4_dwords ( x4,  x5,  x6,  x7, m10, m11, m12, m13);
-    transpose_4x4_dwords ( x8,  x9, x10, x11, m20, m21, m22, m23);
-    transpose_4x4_dwords (x12, x13, x14, x15, m30, m31, m32, m33);
-    m00 = transpose_4x4 (m00);
-    m01 = transpose_4x4 (m01);
-    m02 = transpose_4x4 (m02);
-    m03 = transpose_4x4 (m03);
-    m10 = transpose_4x4 (m10);
-    m11 = transpose_4x4 (m11);
-    m12 = transpose_4x4 (m12);
-    m13 = transpose_4x4 (m13);
-    m20 = transpose_4x4 (m20);
-    m21 = transpose_4x4 (m21);
-    m22 = transpose_4x4 (m22);
-    m23 = transpose_4x4 (m23);
-    m30 = transpose_4x4 (m30);
-    m31 = transpose_4x4 (m31);
-    m32 = transpose_4x4 (m32);
-    m33 = transpose_4x4 (m33);
-    transpose_4x4_dwords (m00, m10, m20, m30,  x0,  x1,  x2, x3);
-    transpose_4x4_dwords (m01, m11, m21, m31,  x4,  x5,  x6, x7);
-    transpose_4x4_dwords (m02, m12, m22, m32,  x8,  x9, x10, x11);
-    transpose_4x4_dwords (m03, m13, m23, m33, x12, x13, x14, x15);
-}
-
 class Read16_Write16_SSE : public Demux
 {
 public:
@@ -445,130 +414,24 @@ public:
         assert (NUM_TIMESLOTS % 16 == 0);
 
         for (size_t dst_num = 0; dst_num < NUM_TIMESLOTS; dst_num += 16) {
-            byte * d0 = dst [dst_num + 0];
-            byte * d1 = dst [dst_num + 1];
-            byte * d2 = dst [dst_num + 2];
-            byte * d3 = dst [dst_num + 3];
-            byte * d4 = dst [dst_num + 4];
-            byte * d5 = dst [dst_num + 5];
-            byte * d6 = dst [dst_num + 6];
-            byte * d7 = dst [dst_num + 7];
-            byte * d8 = dst [dst_num + 8];
-            byte * d9 = dst [dst_num + 9];
-            byte * d10= dst [dst_num +10];
-            byte * d11= dst [dst_num +11];
-            byte * d12= dst [dst_num +12];
-            byte * d13= dst [dst_num +13];
-            byte * d14= dst [dst_num +14];
-            byte * d15= dst [dst_num +15];
             for (size_t dst_pos = 0; dst_pos < DST_SIZE; dst_pos += 16) {
-
-#define LOADREG(i) __m128i w##i = _128i_load (&src [(dst_pos + i) * NUM_TIMESLOTS + dst_num])
-#define STOREREG(i) _128i_store (&d##i [dst_pos], w##i)
-
-                LOADREG (0);  LOADREG (1);  LOADREG (2);  LOADREG (3);
-                LOADREG (4);  LOADREG (5);  LOADREG (6);  LOADREG (7);
-                LOADREG (8);  LOADREG (9);  LOADREG (10); LOADREG (11);
-                LOADREG (12); LOADREG (13); LOADREG (14); LOADREG (15);
-                transpose_16x16 (w0, w1, w2, w3, w4, w5, w6, w7, w8, w9, w10, w11, w12, w13, w14, w15);
-                STOREREG (0);  STOREREG (1);  STOREREG (2);  STOREREG (3);
-                STOREREG (4);  STOREREG (5);  STOREREG (6);  STOREREG (7);
-                STOREREG (8);  STOREREG (9);  STOREREG (10); STOREREG (11);
-                STOREREG (12); STOREREG (13); STOREREG (14); STOREREG (15);
-#undef LOADREG
-#undef STOREREG 
-           }
-        }
-    }
-};
-
-// a macro version of transpose_16x16. The original function is so big that the compiler does not always
-// inline it; only defining it as a macro inlines it reliably.
-
-#define _transpose_16x16(x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15) do {\
-    __m128i m00, m01, m02, m03;\
-    __m128i m10, m11, m12, m13;\
-    __m128i m20, m21, m22, m23;\
-    __m128i m30, m31, m32, m33;\
-    transpose_4x4_dwords ( x0,  x1,  x2,  x3, m00, m01, m02, m03);\
-    transpose_4x4_dwords ( x4,  x5,  x6,  x7, m10, m11, m12, m13);\
-    transpose_4x4_dwords ( x8,  x9, x10, x11, m20, m21, m22, m23);\
-    transpose_4x4_dwords (x12, x13, x14, x15, m30, m31, m32, m33);\
-    m00 = transpose_4x4 (m00);\
-    m01 = transpose_4x4 (m01);\
-    m02 = transpose_4x4 (m02);\
-    m03 = transpose_4x4 (m03);\
-    m10 = transpose_4x4 (m10);\
-    m11 = transpose_4x4 (m11);\
-    m12 = transpose_4x4 (m12);\
-    m13 = transpose_4x4 (m13);\
-    m20 = transpose_4x4 (m20);\
-    m21 = transpose_4x4 (m21);\
-    m22 = transpose_4x4 (m22);\
-    m23 = transpose_4x4 (m23);\
-    m30 = transpose_4x4 (m30);\
-    m31 = transpose_4x4 (m31);\
-    m32 = transpose_4x4 (m32);\
-    m33 = transpose_4x4 (m33);\
-    transpose_4x4_dwords (m00, m10, m20, m30,  x0,  x1,  x2, x3);\
-    transpose_4x4_dwords (m01, m11, m21, m31,  x4,  x5,  x6, x7);\
-    transpose_4x4_dwords (m02, m12, m22, m32,  x8,  x9, x10, x11);\
-    transpose_4x4_dwords (m03, m13, m23, m33, x12, x13, x14, x15);\
-} while (0)
-
-class Read16_Write16_SSE_Unroll : public Demux
-{
-public:
-    void demux (const byte * src, size_t src_length, byte ** dst) const
-    {
-        assert (src_length == NUM_TIMESLOTS * DST_SIZE);
-        assert (DST_SIZE == 64);
-        assert (NUM_TIMESLOTS % 16 == 0);
-
-        for (size_t dst_num = 0; dst_num < NUM_TIMESLOTS; dst_num += 16) {
-            byte * d0 = dst [dst_num + 0];
-            byte * d1 = dst [dst_num + 1];
-            byte * d2 = dst [dst_num + 2];
-            byte * d3 = dst [dst_num + 3];
-            byte * d4 = dst [dst_num + 4];
-            byte * d5 = dst [dst_num + 5];
-            byte * d6 = dst [dst_num + 6];
-            byte * d7 = dst [dst_num + 7];
-            byte * d8 = dst [dst_num + 8];
-            byte * d9 = dst [dst_num + 9];
-            byte * d10= dst [dst_num +10];
-            byte * d11= dst [dst_num +11];
-            byte * d12= dst [dst_num +12];
-            byte * d13= dst [dst_num +13];
-            byte * d14= dst [dst_num +14];
-            byte * d15= dst [dst_num +15];
-
-#define LOADREG(dst_pos, i) __m128i w##i = _128i_load (&src [(dst_pos + i) * NUM_TIMESLOTS + dst_num])
-#define STOREREG(dst_pos, i) _128i_store (&d##i [dst_pos], w##i)
-
-#define MOVE256(dst_pos) do {\
-                LOADREG (dst_pos, 0);  LOADREG (dst_pos, 1);  LOADREG (dst_pos, 2);  LOADREG (dst_pos, 3);\
-                LOADREG (dst_pos, 4);  LOADREG (dst_pos, 5);  LOADREG (dst_pos, 6);  LOADREG (dst_pos, 7);\
-                LOADREG (dst_pos, 8);  LOADREG (dst_pos, 9);  LOADREG (dst_pos, 10); LOADREG (dst_pos, 11);\
-                LOADREG (dst_pos, 12); LOADREG (dst_pos, 13); LOADREG (dst_pos, 14); LOADREG (dst_pos, 15);\
-                _transpose_16x16 (w0, w1, w2, w3, w4, w5, w6, w7, w8, w9, w10, w11, w12, w13, w14, w15);\
-                STOREREG (dst_pos, 0);  STOREREG (dst_pos, 1);  STOREREG (dst_pos, 2);  STOREREG (dst_pos, 3);\
-                STOREREG (dst_pos, 4);  STOREREG (dst_pos, 5);  STOREREG (dst_pos, 6);  STOREREG (dst_pos, 7);\
-                STOREREG (dst_pos, 8);  STOREREG (dst_pos, 9);  STOREREG (dst_pos, 10); STOREREG (dst_pos, 11);\
-                STOREREG (dst_pos, 12); STOREREG (dst_pos, 13); STOREREG (dst_pos, 14); STOREREG (dst_pos, 15);\
-            } while (0)
-
-            MOVE256 (0);
-            MOVE256 (16);
-            MOVE256 (32);
-            MOVE256 (48);
-#undef MOVE256
-#undef LOADREG
-#undef STOREREG 
+                __m128i w [16];
+                for (size_t i = 0; i < 16; i++) {
+                    w [i] = _128i_load (&src [(dst_pos + i) * NUM_TIMESLOTS + dst_num]);
+                }
+                transpose_16x16 (w);
+                for (size_t i = 0; i < 16; i++) {
+                    _128i_store (&dst [dst_num + i][dst_pos], w [i]);
+                }
+            }
         }
     }
 };
 
+#endif
+
+#ifdef __AVX2__
+
 class Read4_Write32_AVX : public Demux
 {
 public:
@@ -692,204 +555,4226 @@ public:
         }
     }
 };
+#endif
 
-class Read8_Write32_AVX_Unroll : public Demux
+// ------- Kernels generated from register blocks
+
+// A register block moves a FRAMES x TIMESLOTS byte matrix: FRAMES frames, starting at src, src + stride, ...,
+// TIMESLOTS bytes each, into the outputs d [0] .. d [TIMESLOTS - 1] at position pos.
+// Unrolled<B> moves the whole source with these blocks, fully unrolled along the frames at compile time.
+// This replaces the LOADREG/MOVE256 macros of the first unrolled versions. The blocks and the transposition
+// helpers are ALWAYS_INLINE, so the compiler cannot decide to call them and keep the matrices in memory.
+// Block_16x16 and Block_32x32 can also show the frames they load to a tracker (see Activity_Tracker):
+// tracker.frames (a, fa, b, fb) gets frames fa and fb (numbers in the whole source) while they are in registers.
+
+/** The tracker of the plain moves: it does nothing, and the code of the moves is the same as without it */
+struct No_Tracker
 {
-public:
-    void demux (const byte * src, size_t src_length, byte ** dst) const
-    {
-        assert (src_length == NUM_TIMESLOTS * DST_SIZE);
-        assert (DST_SIZE == 64);
-        assert (NUM_TIMESLOTS % 8 == 0);
+    template<class V> ALWAYS_INLINE void frames (V, size_t, V, size_t) {}
+};
 
-        for (size_t dst_num = 0; dst_num < NUM_TIMESLOTS; dst_num += 8) {
-            byte * d0 = dst [dst_num + 0];
-            byte * d1 = dst [dst_num + 1];
-            byte * d2 = dst [dst_num + 2];
-            byte * d3 = dst [dst_num + 3];
-            byte * d4 = dst [dst_num + 4];
-            byte * d5 = dst [dst_num + 5];
-            byte * d6 = dst [dst_num + 6];
-            byte * d7 = dst [dst_num + 7];
+struct Block_4x4_Scalar
+{
+    static const size_t FRAMES = 4;
+    static const size_t TIMESLOTS = 4;
 
-#define LOAD32(m0, m1, dst_pos) do {\
-                    __m64 w0 = * (__m64 *) &src [(dst_pos + 0) * NUM_TIMESLOTS + dst_num];\
-                    __m64 w1 = * (__m64 *) &src [(dst_pos + 1) * NUM_TIMESLOTS + dst_num];\
-                    __m64 w2 = * (__m64 *) &src [(dst_pos + 2) * NUM_TIMESLOTS + dst_num];\
-                    __m64 w3 = * (__m64 *) &src [(dst_pos + 3) * NUM_TIMESLOTS + dst_num];\
-                    __m128i x0 = _mm_setr_epi64 (w0, w1);\
-                    __m128i x1 = _mm_setr_epi64 (w2, w3);\
-                    m0 = _128i_shuffle (x0, x1, 0, 2, 0, 2);\
-                    m1 = _128i_shuffle (x0, x1, 1, 3, 1, 3);\
-                    m0 = transpose_4x4 (m0);\
-                    m1 = transpose_4x4 (m1);\
-                } while (0)
+    static ALWAYS_INLINE void move (const byte * src, size_t stride, byte * const * d, size_t pos)
+    {
+        uint32_t w0 = * (uint32_t*) &src [0 * stride];
+        uint32_t w1 = * (uint32_t*) &src [1 * stride];
+        uint32_t w2 = * (uint32_t*) &src [2 * stride];
+        uint32_t w3 = * (uint32_t*) &src [3 * stride];
+        * (uint32_t*) &d [0][pos] = make_32 (byte0 (w0), byte0 (w1), byte0 (w2), byte0 (w3));
+        * (uint32_t*) &d [1][pos] = make_32 (byte1 (w0), byte1 (w1), byte1 (w2), byte1 (w3));
+        * (uint32_t*) &d [2][pos] = make_32 (byte2 (w0), byte2 (w1), byte2 (w2), byte2 (w3));
+        * (uint32_t*) &d [3][pos] = make_32 (byte3 (w0), byte3 (w1), byte3 (w2), byte3 (w3));
+    }
+};
 
-#define MOVE256(dst_pos) do {\
-                __m128i a0, a1, a2, a3, b0, b1, b2, b3;\
-                LOAD32 (a0, b0, dst_pos);\
-                LOAD32 (a1, b1, dst_pos + 4);\
-                LOAD32 (a2, b2, dst_pos + 8);\
-                LOAD32 (a3, b3, dst_pos + 12);\
-\
-                __m128i c0, c1, c2, c3, e0, e1, e2, e3;\
-                LOAD32 (c0, e0, dst_pos + 16);\
-                LOAD32 (c1, e1, dst_pos + 20);\
-                LOAD32 (c2, e2, dst_pos + 24);\
-                LOAD32 (c3, e3, dst_pos + 28);\
-\
-                __m256i w0 = _256i_combine_lo_hi (a0, c0);\
-                __m256i w1 = _256i_combine_lo_hi (a1, c1);\
-                __m256i w2 = _256i_combine_lo_hi (a2, c2);\
-                __m256i w3 = _256i_combine_lo_hi (a3, c3);\
-                __m256i w4 = _256i_combine_lo_hi (b0, e0);\
-                __m256i w5 = _256i_combine_lo_hi (b1, e1);\
-                __m256i w6 = _256i_combine_lo_hi (b2, e2);\
-                __m256i w7 = _256i_combine_lo_hi (b3, e3);\
-\
-                transpose_avx_4x4_dwords (w0, w1, w2, w3);\
-                _256i_store (&d0 [dst_pos], w0);\
-                _256i_store (&d1 [dst_pos], w1);\
-                _256i_store (&d2 [dst_pos], w2);\
-                _256i_store (&d3 [dst_pos], w3);\
-\
-                transpose_avx_4x4_dwords (w4, w5, w6, w7);\
-                _256i_store (&d4 [dst_pos], w4);\
-                _256i_store (&d5 [dst_pos], w5);\
-                _256i_store (&d6 [dst_pos], w6);\
-                _256i_store (&d7 [dst_pos], w7);\
-            } while (0)
-
-            MOVE256 (0);
-            MOVE256 (32);
-#undef LOAD32
-#undef MOVE256
-        }
+struct Block_8x8_SWAR
+{
+    static const size_t FRAMES = 8;
+    static const size_t TIMESLOTS = 8;
+
+    static ALWAYS_INLINE void move (const byte * src, size_t stride, byte * const * d, size_t pos)
+    {
+        uint64_t w [8];
+        unroll<8> ([&] (auto i) ALWAYS_INLINE_LAMBDA { w [i] = * (uint64_t*) &src [i * stride]; });
+        transpose_8x8 (w);
+        unroll<8> ([&] (auto i) ALWAYS_INLINE_LAMBDA { * (uint64_t*) &d [i][pos] = w [i]; });
     }
 };
 
-class Null: public Demux
+#ifdef __SSE4_1__
+
+struct Block_16x8_SSE
 {
-public:
-    void demux (const byte * src, size_t src_length, byte ** dst) const
+    static const size_t FRAMES = 16;
+    static const size_t TIMESLOTS = 8;
+
+    /** loads 16 frames of 8 bytes as two sets of 4x4 dword matrices, with every dword transposed:
+      * a [i] has timeslots 0-3 of frames 4*i .. 4*i+3, b [i] has timeslots 4-7.
+      */
+    static ALWAYS_INLINE void load (const byte * src, size_t stride, __m128i (&a) [4], __m128i (&b) [4])
     {
-        assert (src_length == NUM_TIMESLOTS * DST_SIZE);
+        unroll<4> ([&] (auto i) ALWAYS_INLINE_LAMBDA {
+            const byte * s = src + 4 * i * stride;
+            __m128i x0 = _mm_unpacklo_epi64 (_mm_loadl_epi64 ((const __m128i *) &s [0 * stride]),
+                                             _mm_loadl_epi64 ((const __m128i *) &s [1 * stride]));
+            __m128i x1 = _mm_unpacklo_epi64 (_mm_loadl_epi64 ((const __m128i *) &s [2 * stride]),
+                                             _mm_loadl_epi64 ((const __m128i *) &s [3 * stride]));
+            a [i] = transpose_4x4 (_128i_shuffle (x0, x1, 0, 2, 0, 2));
+            b [i] = transpose_4x4 (_128i_shuffle (x0, x1, 1, 3, 1, 3));
+        });
+    }
+
+    static ALWAYS_INLINE void move (const byte * src, size_t stride, byte * const * d, size_t pos)
+    {
+        __m128i a [4], b [4];
+        load (src, stride, a, b);
+        transpose_4x4_dwords (a [0], a [1], a [2], a [3]);
+        transpose_4x4_dwords (b [0], b [1], b [2], b [3]);
+        unroll<4> ([&] (auto i) ALWAYS_INLINE_LAMBDA {
+            _128i_store (&d [i][pos], a [i]);
+            _128i_store (&d [4 + i][pos], b [i]);
+        });
     }
 };
 
-class Copy: public Demux
+#endif
+
+// The 16x16 transpositions for Block_16x16 and Block_32x32
+
+struct Shuffle_16x16
 {
-public:
-    void demux (const byte * src, size_t src_length, byte ** dst) const
+    template<class V> static ALWAYS_INLINE void transpose (V (&x) [16]) { transpose_16x16 (x); }
+};
+
+struct Unpack_16x16
+{
+    template<class V> static ALWAYS_INLINE void transpose (V (&x) [16]) { transpose_16x16_unpack (x); }
+};
+
+template<class T> struct Block_16x16
+{
+    static const size_t FRAMES = 16;
+    static const size_t TIMESLOTS = 16;
+    typedef __m128i Frame;
+
+    template<class Tracker> static ALWAYS_INLINE void move (const byte * src, size_t stride, byte * const * d, size_t pos,
+                                                             Tracker & tracker)
     {
-        assert (src_length == NUM_TIMESLOTS * DST_SIZE);
+        __m128i w [16];
+        unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA { w [i] = _128i_load (&src [i * stride]); });
+        unroll<8> ([&] (auto i) ALWAYS_INLINE_LAMBDA {
+            tracker.frames (w [2 * i], pos + 2 * i, w [2 * i + 1], pos + 2 * i + 1);
+        });
+        T::transpose (w);
+        unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA { _128i_store (&d [i][pos], w [i]); });
+    }
 
-        for (size_t dst_num = 0; dst_num < NUM_TIMESLOTS; dst_num ++) {
-            memcpy (dst[dst_num], src + dst_num * DST_SIZE, DST_SIZE);
-        }
+    static ALWAYS_INLINE void move (const byte * src, size_t stride, byte * const * d, size_t pos)
+    {
+        No_Tracker tracker;
+        move (src, stride, d, pos, tracker);
     }
 };
 
-class Copy_AVX: public Demux
+typedef Block_16x16<Shuffle_16x16> Block_16x16_SSE;
+typedef Block_16x16<Unpack_16x16> Block_16x16_SSE2;
+
+#ifdef __AVX2__
+
+struct Block_32x8_AVX
 {
-public:
-    void demux (const byte * src, size_t src_length, byte ** dst) const
+    static const size_t FRAMES = 32;
+    static const size_t TIMESLOTS = 8;
+
+    static ALWAYS_INLINE void move (const byte * src, size_t stride, byte * const * d, size_t pos)
     {
-        assert (src_length == NUM_TIMESLOTS * DST_SIZE);
-        assert (DST_SIZE % 32 == 0);
+        __m128i a [4], b [4], c [4], e [4];
+        Block_16x8_SSE::load (src, stride, a, b);
+        Block_16x8_SSE::load (src + 16 * stride, stride, c, e);
 
-        for (size_t dst_num = 0; dst_num < NUM_TIMESLOTS; dst_num ++) {
-            byte * d = dst [dst_num];
-            for (size_t dst_pos = 0; dst_pos < DST_SIZE; dst_pos += 32) {
-                _256i_store (d + dst_pos,
-                             _mm256_load_si256 ((__m256i const *) (src + dst_num * DST_SIZE + dst_pos)));
-            }
-        }
+        __m256i w [8];
+        unroll<4> ([&] (auto i) ALWAYS_INLINE_LAMBDA {
+            w [i] = _256i_combine_lo_hi (a [i], c [i]);
+            w [4 + i] = _256i_combine_lo_hi (b [i], e [i]);
+        });
+        transpose_avx_4x4_dwords (w [0], w [1], w [2], w [3]);
+        transpose_avx_4x4_dwords (w [4], w [5], w [6], w [7]);
+        unroll<8> ([&] (auto i) ALWAYS_INLINE_LAMBDA { _256i_store (&d [i][pos], w [i]); });
     }
 };
 
-byte * generate ()
+#endif
+
+/** transposes an 8x16 byte matrix: 8 rows of 16 bytes (8 frames of 16 timeslots) into 16 rows of 8 bytes,
+  * with a cascade of unpack instructions (SSE2 only), and stores the rows to d[0] .. d[15] at position pos.
+  * The 8-byte stores do not need to be aligned.
+  */
+inline void transpose_8x16_store (__m128i r0, __m128i r1, __m128i r2, __m128i r3,
+                                  __m128i r4, __m128i r5, __m128i r6, __m128i r7,
+                                  byte * const * d, size_t pos)
 {
-    byte * buf = (byte*) _mm_malloc (SRC_SIZE, 32); // new byte [SRC_SIZE];
-    srand (0);
-    for (size_t i = 0; i < SRC_SIZE; i++) buf[i] = (byte) (rand () % 256);
-    return buf;
+    __m128i a0 = _mm_unpacklo_epi8 (r0, r1);    // t0: f0 f1, t1: f0 f1, ... t7: f0 f1
+    __m128i a1 = _mm_unpackhi_epi8 (r0, r1);    // t8 .. t15
+    __m128i a2 = _mm_unpacklo_epi8 (r2, r3);    // t0 .. t7: f2 f3
+    __m128i a3 = _mm_unpackhi_epi8 (r2, r3);
+    __m128i a4 = _mm_unpacklo_epi8 (r4, r5);
+    __m128i a5 = _mm_unpackhi_epi8 (r4, r5);
+    __m128i a6 = _mm_unpacklo_epi8 (r6, r7);
+    __m128i a7 = _mm_unpackhi_epi8 (r6, r7);
+
+    __m128i b0 = _mm_unpacklo_epi16 (a0, a2);   // t0: f0 f1 f2 f3, ... t3: f0 f1 f2 f3
+    __m128i b1 = _mm_unpackhi_epi16 (a0, a2);   // t4 .. t7
+    __m128i b2 = _mm_unpacklo_epi16 (a1, a3);   // t8 .. t11
+    __m128i b3 = _mm_unpackhi_epi16 (a1, a3);   // t12 .. t15
+    __m128i b4 = _mm_unpacklo_epi16 (a4, a6);   // t0 .. t3: f4 f5 f6 f7
+    __m128i b5 = _mm_unpackhi_epi16 (a4, a6);
+    __m128i b6 = _mm_unpacklo_epi16 (a5, a7);
+    __m128i b7 = _mm_unpackhi_epi16 (a5, a7);
+
+    __m128i c0 = _mm_unpacklo_epi32 (b0, b4);   // t0: f0 .. f7, t1: f0 .. f7
+    __m128i c1 = _mm_unpackhi_epi32 (b0, b4);   // t2, t3
+    __m128i c2 = _mm_unpacklo_epi32 (b1, b5);   // t4, t5
+    __m128i c3 = _mm_unpackhi_epi32 (b1, b5);   // t6, t7
+    __m128i c4 = _mm_unpacklo_epi32 (b2, b6);   // t8, t9
+    __m128i c5 = _mm_unpackhi_epi32 (b2, b6);   // t10, t11
+    __m128i c6 = _mm_unpacklo_epi32 (b3, b7);   // t12, t13
+    __m128i c7 = _mm_unpackhi_epi32 (b3, b7);   // t14, t15
+
+#define STORE2(c, i) do {\
+        _mm_storel_epi64 ((__m128i *) &d [i][pos], c);\
+        _mm_storeh_pd ((double *) &d [i + 1][pos], _mm_castsi128_pd (c));\
+    } while (0)
+
+    STORE2 (c0, 0);  STORE2 (c1, 2);  STORE2 (c2, 4);  STORE2 (c3, 6);
+    STORE2 (c4, 8);  STORE2 (c5, 10); STORE2 (c6, 12); STORE2 (c7, 14);
+#undef STORE2
 }
-    
-byte ** allocate_dst ()
+
+struct Block_8x16_SSE2
 {
-    byte ** result = new byte * [NUM_TIMESLOTS];
-    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
-        result [i] = (byte *) _mm_malloc (DST_SIZE, 32); // new byte [DST_SIZE];
-        memset (result [i], 0, DST_SIZE);
+    static const size_t FRAMES = 8;
+    static const size_t TIMESLOTS = 16;
+
+    static ALWAYS_INLINE void move (const byte * src, size_t stride, byte * const * d, size_t pos)
+    {
+        __m128i r [8];
+        unroll<8> ([&] (auto i) ALWAYS_INLINE_LAMBDA { r [i] = _128i_load (&src [i * stride]); });
+        transpose_8x16_store (r [0], r [1], r [2], r [3], r [4], r [5], r [6], r [7], d, pos);
     }
-    return result;
-}
+};
 
-void delete_dst (byte ** dst)
+#ifdef __AVX2__
+
+/** 32 frames of 32 timeslots: two 16x16 transpositions in 256-bit registers (frames 0-15 and 16-31),
+  * each of them transposing timeslots 0-15 in the low halves and 16-31 in the high halves.
+  * The low halves of the results go to timeslots 0-15, the high halves to 16-31.
+  */
+template<class T> struct Block_32x32
 {
-    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
-        _mm_free (dst [i]); // delete dst [i];
+    static const size_t FRAMES = 32;
+    static const size_t TIMESLOTS = 32;
+    typedef __m256i Frame;
+
+    /** loads and transposes the block: w [i] has timeslots i and 16 + i of frames 0-15, v [i] of frames 16-31.
+      * The frames are shown to the tracker, which gets frames pos + i and pos + 16 + i, as they are loaded.
+      */
+    template<class Tracker> static ALWAYS_INLINE void transpose (const byte * src, size_t stride, size_t pos,
+                                                                  __m256i (&w) [16], __m256i (&v) [16], Tracker & tracker)
+    {
+        unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA {
+            w [i] = _mm256_load_si256 ((const __m256i *) &src [i * stride]);
+            v [i] = _mm256_load_si256 ((const __m256i *) &src [(16 + i) * stride]);
+            tracker.frames (w [i], pos + i, v [i], pos + 16 + i);
+        });
+        T::transpose (w);
+        T::transpose (v);
     }
-    delete dst;
-}
-    
-void check (const Demux & demux)
+
+    static ALWAYS_INLINE void transpose (const byte * src, size_t stride, __m256i (&w) [16], __m256i (&v) [16])
+    {
+        No_Tracker tracker;
+        transpose (src, stride, 0, w, v, tracker);
+    }
+
+    template<class Tracker> static ALWAYS_INLINE void move (const byte * src, size_t stride, byte * const * d, size_t pos,
+                                                             Tracker & tracker)
+    {
+        __m256i w [16], v [16];
+        transpose (src, stride, pos, w, v, tracker);
+        unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA {
+            _256i_store (&d [i][pos], _mm256_permute2x128_si256 (w [i], v [i], 0x20));
+            _256i_store (&d [16 + i][pos], _mm256_permute2x128_si256 (w [i], v [i], 0x31));
+        });
+    }
+
+    static ALWAYS_INLINE void move (const byte * src, size_t stride, byte * const * d, size_t pos)
+    {
+        No_Tracker tracker;
+        move (src, stride, d, pos, tracker);
+    }
+};
+
+typedef Block_32x32<Shuffle_16x16> Block_32x32_AVX2;
+typedef Block_32x32<Unpack_16x16> Block_32x32_AVX2_Unpack;
+
+#endif
+
+// The unpack cascade of Block_16x16_SSE2 and Block_32x32_AVX2_Unpack, written with vector extensions (vec.h)
+// rather than intrinsics, so the same source compiles for SSE2, AVX2 and AVX-512 targets.
+// The 32- and 64-byte ones are left out of builds without AVX and AVX-512BW respectively: GCC would split
+// their vectors into narrower ones, which is many times slower, and warn about the ABI of the vectors it passes around.
+
+struct Block_16x16_Vec
 {
-    byte * src = generate ();
-    byte ** dst0 = allocate_dst ();
-    byte ** dst = allocate_dst ();
-    Reference().demux (src, SRC_SIZE, dst0);
-    demux.demux (src, SRC_SIZE, dst);
+    static const size_t FRAMES = 16;
+    static const size_t TIMESLOTS = 16;
 
-    for (int i = 0; i < NUM_TIMESLOTS; i++) {
-        if (memcmp (dst0[i], dst[i], DST_SIZE)) {
-            cout << "Results not equal: line " << i << "\n";
-            exit (1);
-        }
+    static ALWAYS_INLINE void move (const byte * src, size_t stride, byte * const * d, size_t pos)
+    {
+        vec16 w [16];
+        unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA { w [i] = vec_load<vec16> (&src [i * stride]); });
+        vec_transpose_16x16 (w);
+        unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA { vec_store (&d [i][pos], w [i]); });
     }
-    delete src;
-    delete_dst (dst0);
-    delete_dst (dst);
-}
+};
 
-byte * src;
-byte ** dst;
+#ifdef __AVX__
 
-void measure (const Demux & demux)
+struct Block_32x32_Vec
 {
-//    check (demux);
+    static const size_t FRAMES = 32;
+    static const size_t TIMESLOTS = 32;
 
-    uint64_t t0 = currentTimeMillis ();
-    for (int i = 0; i < ITERATIONS; i++) {
-        demux.demux (src, SRC_SIZE, dst);
+    static ALWAYS_INLINE void move (const byte * src, size_t stride, byte * const * d, size_t pos)
+    {
+        vec32 w [16], v [16];
+        unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA {
+            w [i] = vec_load<vec32> (&src [i * stride]);
+            v [i] = vec_load<vec32> (&src [(16 + i) * stride]);
+        });
+        vec_transpose_16x16 (w);
+        vec_transpose_16x16 (v);
+        unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA {
+            vec_store (&d [i][pos], vec_combine<false> (w [i], v [i]));
+            vec_store (&d [16 + i][pos], vec_combine<true> (w [i], v [i]));
+        });
     }
-    uint64_t t = currentTimeMillis () - t0;
-    cout << typeid (demux).name() << ": " << t << endl;
-}
+};
+
+#endif
 
-int main (void)
+#ifdef __AVX512BW__
+
+/** 32 frames of 32 timeslots in 16 registers of 64 bytes: register i holds frames i and 16 + i, so its lanes
+  * are four 16x16 matrices (frames 0-15 and 16-31, timeslots 0-15 and 16-31), all transposed at once.
+  * It is correct on any target, but without AVX-512BW GCC expands the 64-byte shuffles into byte moves and it is
+  * twenty times slower, so it is only built for AVX-512.
+  */
+struct Block_32x32_Vec512
 {
-    src = generate ();
-    dst = allocate_dst ();
+    static const size_t FRAMES = 32;
+    static const size_t TIMESLOTS = 32;
 
-    measure (Reference ());
-    measure (Write4 ());
-    measure (Write8 ());
-    measure (Read4_Write4 ());
-    measure (Read4_Write4_Unroll ());
-    measure (Read4_Write4_SSE ());
-    measure (Read4_Write16_SSE ());
-    measure (Read8_Write16_SSE ());
-    measure (Read8_Write16_SSE_Unroll ());
-    measure (Read16_Write16_SSE ());
-    measure (Read16_Write16_SSE_Unroll ());
-    measure (Read4_Write32_AVX ());
-    measure (Read8_Write32_AVX ());
-    measure (Read8_Write32_AVX_Unroll ());
-    measure (Null ());
-    measure (Copy ());
-    measure (Copy_AVX ());
+    static ALWAYS_INLINE void move (const byte * src, size_t stride, byte * const * d, size_t pos)
+    {
+        vec64 x [16];
+        unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA {
+            x [i] = vec_load_halves (&src [i * stride], &src [(16 + i) * stride]);
+        });
+        vec_transpose_16x16 (x);
+        unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA {
+            vec_store_halves (&d [i][pos], &d [16 + i][pos], vec_swap_lanes (x [i]));
+        });
+    }
+};
+
+#endif
+
+template<class B> class Unrolled : public Demux
+{
+public:
+    void demux (const byte * src, size_t src_length, byte ** dst) const
+    {
+        static_assert (NUM_TIMESLOTS % B::TIMESLOTS == 0, "the number of timeslots must be a multiple of the block width");
+        static_assert (DST_SIZE % B::FRAMES == 0, "the block size must be a multiple of the block height");
+        assert (src_length == NUM_TIMESLOTS * DST_SIZE);
+
+        for (size_t dst_num = 0; dst_num < NUM_TIMESLOTS; dst_num += B::TIMESLOTS) {
+            byte * d [B::TIMESLOTS];
+            unroll<B::TIMESLOTS> ([&] (auto i) ALWAYS_INLINE_LAMBDA { d [i] = dst [dst_num + i]; });
+            unroll<DST_SIZE / B::FRAMES> ([&] (auto i) ALWAYS_INLINE_LAMBDA {
+                B::move (&src [i * B::FRAMES * NUM_TIMESLOTS + dst_num], NUM_TIMESLOTS, d, i * B::FRAMES);
+            });
+        }
+    }
+};
+
+class Read4_Write4_Unroll : public Unrolled<Block_4x4_Scalar> {};
+class Read8_Write8_Unroll : public Unrolled<Block_8x8_SWAR> {};
+class Read16_Write8_SSE2_Unroll : public Unrolled<Block_8x16_SSE2> {};
+class Read16_Write16_SSE2_Unroll : public Unrolled<Block_16x16_SSE2> {};
+#ifdef __SSE4_1__
+class Read8_Write16_SSE_Unroll : public Unrolled<Block_16x8_SSE> {};
+class Read16_Write16_SSE_Unroll : public Unrolled<Block_16x16_SSE> {};
+#endif
+#ifdef __AVX2__
+class Read8_Write32_AVX_Unroll : public Unrolled<Block_32x8_AVX> {};
+class Read32_Write32_AVX2_Unroll : public Unrolled<Block_32x32_AVX2> {};
+class Read32_Write32_AVX2_Unpack_Unroll : public Unrolled<Block_32x32_AVX2_Unpack> {};
+#endif
+class Read16_Write16_Vec_Unroll : public Unrolled<Block_16x16_Vec> {};
+#ifdef __AVX__
+class Read32_Write32_Vec_Unroll : public Unrolled<Block_32x32_Vec> {};
+#endif
+#ifdef __AVX512BW__
+class Read32_Write32_Vec512_Unroll : public Unrolled<Block_32x32_Vec512> {};
+#endif
+
+/** Activity of timeslots in one demultiplexed block.
+  * A timeslot is idle if its second half (frames 32-63) repeats the first half (frames 0-31). This is true for
+  * constant silence and for the idle codes, which are either constant (0xD5, 0x54) or alternate with a period
+  * that divides 32 frames, while speech practically never repeats exactly for 4 ms.
+  * The energy is a sum of A-law magnitude codes (byte XOR 0x55 without the sign bit) over all bytes of the timeslot.
+  * It is not a linear power, but it is monotonic with the signal level and is cheap to calculate.
+  */
+struct Activity
+{
+    uint32_t active;                   // bit i is set if timeslot i is active
+    uint32_t energy [NUM_TIMESLOTS];
+};
+
+/** Collects the activity of a group of B::TIMESLOTS timeslots from the frames of register blocks B
+  * while they are in registers (of type B::Frame), for Unrolled_Activity.
+  * A frame of the second half is XORed with the frame of the first half that it must repeat (a load from the source,
+  * which is a memory operand of the XOR) and ORed into diff. It is done on frames rather than on the transposed rows:
+  * a frame holds all the timeslots of the group, so one register accumulates them all, while a transposed row holds
+  * one timeslot and would need a horizontal reduction of its own. That is two operations per frame of the second half
+  * (one with AVX-512VL), and no shuffles.
+  * The energy adds the magnitudes of two frames as bytes (they fit) and then as 16-bit words: the low words include
+  * the odd timeslots multiplied by 256, which are subtracted at the end. It is calculated only if ENERGY is true:
+  * it costs four operations per frame, which is comparable with the transposition itself.
+  */
+template<class B, bool ENERGY> class Activity_Tracker
+{
+    typedef typename B::Frame V;
+    static const size_t PERIOD = DST_SIZE / 2;
+
+    const byte * const src;
+    V diff, energy_lo, energy_hi;
+
+public:
+    /** @param src  the first frame of the group in the source block */
+    ALWAYS_INLINE Activity_Tracker (const byte * src)
+        : src (src), diff (set_bytes<V> (0)), energy_lo (set_bytes<V> (0)), energy_hi (set_bytes<V> (0))
+    {
+    }
+
+    ALWAYS_INLINE void frames (V a, size_t fa, V b, size_t fb)
+    {
+        if (fa >= PERIOD) diff = or_xor (diff, a, load_vector<V> (src + (fa - PERIOD) * NUM_TIMESLOTS));
+        if (fb >= PERIOD) diff = or_xor (diff, b, load_vector<V> (src + (fb - PERIOD) * NUM_TIMESLOTS));
+        if (! ENERGY) return;
+        const V alaw_xor = set_bytes<V> (0x55);
+        const V magnitude = set_bytes<V> (0x7F);
+        V m = add_bytes (and_bits (xor_bits (a, alaw_xor), magnitude), and_bits (xor_bits (b, alaw_xor), magnitude));
+        energy_lo = add_words (energy_lo, m);
+        energy_hi = add_words (energy_hi, high_bytes (m));
+    }
+
+    /** Stores the activity of the group, which starts at timeslot first */
+    ALWAYS_INLINE void result (Activity & activity, size_t first) const
+    {
+        const size_t n = B::TIMESLOTS;
+        static_assert (n == sizeof (V), "a frame of the group must fill the register");
+        activity.active |= (uint32_t) (~zero_bytes (diff) & (uint32_t) ((1ULL << n) - 1)) << first;
+        if (! ENERGY) return;
+        uint16_t lo [n / 2], hi [n / 2];
+        memcpy (lo, &energy_lo, sizeof (lo));
+        memcpy (hi, &energy_hi, sizeof (hi));
+        for (size_t i = 0; i < n / 2; i++) {
+            activity.energy [first + 2 * i] = (uint16_t) (lo [i] - (hi [i] << 8));
+            activity.energy [first + 2 * i + 1] = hi [i];
+        }
+    }
+};
+
+/** An Unrolled kernel that also fills an Activity structure (the energy only if ENERGY is true), for blocks that show
+  * their frames to a tracker (Block_16x16 and Block_32x32); the plain Unrolled<B> has none of this code.
+  * The checks run between the loads and the transposition of every register block, on the ALU ports,
+  * while the transposition keeps the shuffle port busy. On the test host the idle bitmap costs nothing measurable
+  * in Read16_Write16_SSE_Activity and about 15% in Read32_Write32_AVX2_Activity, whose transposition leaves fewer
+  * free slots on the ALU ports (5% with VPTERNLOGQ); the energy adds 70-80% to either.
+  */
+template<class B, bool ENERGY = false> class Unrolled_Activity : public Unrolled<B>
+{
+    Activity & activity;
+
+public:
+    Unrolled_Activity (Activity & activity) : activity (activity)
+    {
+    }
+
+    void demux (const byte * src, size_t src_length, byte ** dst) const
+    {
+        static_assert (DST_SIZE % (2 * B::FRAMES) == 0, "the halves of the source must consist of whole blocks");
+        assert (src_length == NUM_TIMESLOTS * DST_SIZE);
+
+        activity.active = 0;
+        for (size_t dst_num = 0; dst_num < NUM_TIMESLOTS; dst_num += B::TIMESLOTS) {
+            Activity_Tracker<B, ENERGY> tracker (&src [dst_num]);
+            byte * d [B::TIMESLOTS];
+            unroll<B::TIMESLOTS> ([&] (auto i) ALWAYS_INLINE_LAMBDA { d [i] = dst [dst_num + i]; });
+            unroll<DST_SIZE / B::FRAMES> ([&] (auto i) ALWAYS_INLINE_LAMBDA {
+                B::move (&src [i * B::FRAMES * NUM_TIMESLOTS + dst_num], NUM_TIMESLOTS, d, i * B::FRAMES, tracker);
+            });
+            tracker.result (activity, dst_num);
+        }
+    }
+};
+
+#ifdef __SSE4_1__
+
+class Read16_Write16_SSE_Activity : public Unrolled_Activity<Block_16x16_SSE>
+{
+public:
+    Read16_Write16_SSE_Activity (Activity & activity) : Unrolled_Activity (activity)
+    {
+    }
+};
+
+#endif
+#ifdef __AVX2__
+
+class Read32_Write32_AVX2_Activity : public Unrolled_Activity<Block_32x32_AVX2>
+{
+public:
+    Read32_Write32_AVX2_Activity (Activity & activity) : Unrolled_Activity (activity)
+    {
+    }
+};
+
+/** The idle timeslots and the energy */
+class Read32_Write32_AVX2_Energy : public Unrolled_Activity<Block_32x32_AVX2, true>
+{
+public:
+    Read32_Write32_AVX2_Energy (Activity & activity) : Unrolled_Activity (activity)
+    {
+    }
+};
+
+#endif
+
+class Null: public Demux
+{
+public:
+    void demux (const byte * src, size_t src_length, byte ** dst) const
+    {
+        assert (src_length == NUM_TIMESLOTS * DST_SIZE);
+    }
+};
+
+class Copy: public Demux
+{
+public:
+    void demux (const byte * src, size_t src_length, byte ** dst) const
+    {
+        assert (src_length == NUM_TIMESLOTS * DST_SIZE);
+
+        for (size_t dst_num = 0; dst_num < NUM_TIMESLOTS; dst_num ++) {
+            memcpy (dst[dst_num], src + dst_num * DST_SIZE, DST_SIZE);
+        }
+    }
+};
+
+#ifdef __AVX2__
+
+class Copy_AVX: public Demux
+{
+public:
+    void demux (const byte * src, size_t src_length, byte ** dst) const
+    {
+        assert (src_length == NUM_TIMESLOTS * DST_SIZE);
+        assert (DST_SIZE % 32 == 0);
+
+        for (size_t dst_num = 0; dst_num < NUM_TIMESLOTS; dst_num ++) {
+            byte * d = dst [dst_num];
+            for (size_t dst_pos = 0; dst_pos < DST_SIZE; dst_pos += 32) {
+                _256i_store (d + dst_pos,
+                             _mm256_load_si256 ((__m256i const *) (src + dst_num * DST_SIZE + dst_pos)));
+            }
+        }
+    }
+};
+
+// ------- In-place demultiplexing
+
+/** Demultiplexes a block within the source buffer: afterwards channel i occupies bytes i * DST_SIZE .. (i+1) * DST_SIZE - 1
+  * of the block. Large offline batches then need no separate output buffers.
+  * The block is a column of DST_SIZE / 32 square tiles of 32 frames. First every tile is transposed in place
+  * by Block_32x32_AVX2, which loads the whole tile before storing anything. Then the 32-byte rows of the
+  * transposed tiles are interleaved (row t of tile j goes to unit t * tiles + j) by following the cycles of
+  * this permutation; the cycle leaders are found once, in the constructor.
+  */
+class In_Place_Demux
+{
+    static const size_t TILE = 32;
+    static const size_t TILES = DST_SIZE / TILE;
+    static const size_t UNITS = TILES * TILE;
+    vector<size_t> leaders;
+
+    /** @return the unit that goes to position p */
+    static size_t source_unit (size_t p)
+    {
+        return p % TILES * TILE + p / TILES;
+    }
+
+public:
+    In_Place_Demux ()
+    {
+        static_assert (NUM_TIMESLOTS == TILE, "a frame must be one tile row");
+        static_assert (DST_SIZE % TILE == 0, "the block must consist of whole tiles");
+        for (size_t s = 0; s < UNITS; s++) {
+            size_t p = source_unit (s);
+            while (p > s) p = source_unit (p);
+            if (p == s && source_unit (s) != s) leaders.push_back (s);
+        }
+    }
+
+    void demux (byte * block) const
+    {
+        byte * d [TILE];
+        for (size_t j = 0; j < TILES; j++) {
+            byte * tile = block + j * TILE * TILE;
+            unroll<TILE> ([&] (auto i) ALWAYS_INLINE_LAMBDA { d [i] = tile + i * TILE; });
+            Block_32x32_AVX2::move (tile, TILE, d, 0);
+        }
+        for (size_t k = 0; k < leaders.size (); k++) {
+            size_t s = leaders [k];
+            __m256i tmp = _mm256_load_si256 ((const __m256i *) (block + s * TILE));
+            size_t p = s;
+            for (size_t q; (q = source_unit (p)) != s; p = q) {
+                _256i_store (block + p * TILE, _mm256_load_si256 ((const __m256i *) (block + q * TILE)));
+            }
+            _256i_store (block + p * TILE, tmp);
+        }
+    }
+
+    /** Demultiplexes consecutive blocks, each in its own place */
+    void demux_blocks (byte * src, size_t blocks) const
+    {
+        for (size_t b = 0; b < blocks; b++) {
+            demux (src + b * SRC_SIZE);
+        }
+    }
+};
+
+#endif
+
+// ------- Long blocks
+
+/** Demultiplexes a block of any number of frames with register block B, sweeping all the frames
+  * for one group of B::TIMESLOTS timeslots, then for the next group. This is how Unrolled<B> works, and it is
+  * fine for short blocks. For long ones every group reads the whole source again, from L2 or further away.
+  * The frames that do not make a whole register block are moved byte by byte.
+  * A frame is TIMESLOTS bytes long; it can differ from NUM_TIMESLOTS (for the geometry sweep, such as 24 for T1).
+  */
+template<class B, size_t TIMESLOTS = NUM_TIMESLOTS> class Swept
+{
+public:
+    void demux (const byte * src, size_t frames, byte * const * dst) const
+    {
+        static_assert (TIMESLOTS % B::TIMESLOTS == 0, "the number of timeslots must be a multiple of the block width");
+        const size_t end = frames / B::FRAMES * B::FRAMES;
+        for (size_t dst_num = 0; dst_num < TIMESLOTS; dst_num += B::TIMESLOTS) {
+            byte * d [B::TIMESLOTS];
+            unroll<B::TIMESLOTS> ([&] (auto i) ALWAYS_INLINE_LAMBDA { d [i] = dst [dst_num + i]; });
+            for (size_t f = 0; f < end; f += B::FRAMES) {
+                B::move (&src [f * TIMESLOTS + dst_num], TIMESLOTS, d, f);
+            }
+        }
+        demux_tail (src, end, frames, dst);
+    }
+
+    static void demux_tail (const byte * src, size_t begin, size_t end, byte * const * dst)
+    {
+        for (size_t f = begin; f < end; f++) {
+            for (size_t i = 0; i < TIMESLOTS; i++) {
+                dst [i][f] = src [f * TIMESLOTS + i];
+            }
+        }
+    }
+};
+
+/** Demultiplexes a long block with register block B, walking the source in tiles of TILE_FRAMES frames.
+  * A tile (8K of source and 8K of output by default) stays in L1 while all timeslot groups are moved from it,
+  * so the source is read from memory once. Within a tile, a group writes B::TIMESLOTS output streams,
+  * so the blocks with fewer timeslots keep the number of streams within the line fill buffers (10 to 12).
+  * The output pointers must be aligned as B requires (32 bytes for the AVX blocks).
+  */
+template<class B, size_t TILE_FRAMES = 256> class Tiled
+{
+public:
+    void demux (const byte * src, size_t frames, byte * const * dst) const
+    {
+        static_assert (TILE_FRAMES % B::FRAMES == 0, "a tile must consist of whole register blocks");
+        const size_t end = frames / B::FRAMES * B::FRAMES;
+        for (size_t tile = 0; tile < end; tile += TILE_FRAMES) {
+            const size_t tile_end = min (tile + TILE_FRAMES, end);
+            for (size_t dst_num = 0; dst_num < NUM_TIMESLOTS; dst_num += B::TIMESLOTS) {
+                byte * d [B::TIMESLOTS];
+                unroll<B::TIMESLOTS> ([&] (auto i) ALWAYS_INLINE_LAMBDA { d [i] = dst [dst_num + i]; });
+                for (size_t f = tile; f < tile_end; f += B::FRAMES) {
+                    B::move (&src [f * NUM_TIMESLOTS + dst_num], NUM_TIMESLOTS, d, f);
+                }
+            }
+        }
+        Swept<B>::demux_tail (src, end, frames, dst);
+    }
+};
+
+#ifdef __AVX2__
+
+// ------- Selected timeslots
+
+/** Demultiplexes only the selected timeslots, with gathers: a full transposition moves all 32 timeslots,
+  * which is a waste when only a few of them are needed. Nothing is written to the other dst pointers.
+  * Gather k of a group of 32 frames loads, for j = 0 .. 7, the dword of frame 4 * j + k that contains the timeslot,
+  * and PSHUFB moves the timeslot byte to byte k of dword j. The four results are ORed, so the bytes come out
+  * in frame order. The dword starts at the timeslot, or earlier for the last three, so it never crosses a frame.
+  * With AVX-512 (F and BW), one group is 64 frames, gathered 16 at a time.
+  */
+class Gather_Select : public Demux
+{
+#if defined (__AVX512F__) && defined (__AVX512BW__)
+    typedef __m512i V;
+#else
+    typedef __m256i V;
+#endif
+    static const size_t FRAMES = sizeof (V);    // frames per group: one output register
+    static const size_t LANES = FRAMES / 4;
+
+    const uint32_t timeslots;
+    V index [4];            // index [k]: offsets of frames 4 * j + k
+    V pack [4][4];          // pack [shift][k]: byte 4 * j + shift to byte 4 * j + k, zero other bytes
+
+    static V gather (V index, const byte * base)
+    {
+#if defined (__AVX512F__) && defined (__AVX512BW__)
+        return _mm512_i32gather_epi32 (index, base, 1);
+#else
+        return _mm256_i32gather_epi32 ((const int *) base, index, 1);
+#endif
+    }
+
+    static V shuffle (V x, V mask)
+    {
+#if defined (__AVX512F__) && defined (__AVX512BW__)
+        return _mm512_shuffle_epi8 (x, mask);
+#else
+        return _mm256_shuffle_epi8 (x, mask);
+#endif
+    }
+
+    static V or_v (V x, V y)
+    {
+#if defined (__AVX512F__) && defined (__AVX512BW__)
+        return _mm512_or_si512 (x, y);
+#else
+        return _mm256_or_si256 (x, y);
+#endif
+    }
+
+public:
+    /** @param timeslots  bit i is set if timeslot i is needed */
+    Gather_Select (uint32_t timeslots) : timeslots (timeslots)
+    {
+        static_assert (NUM_TIMESLOTS == 32, "the selection is a 32-bit mask");
+        static_assert (DST_SIZE % FRAMES == 0, "the block must consist of whole groups");
+        for (size_t k = 0; k < 4; k++) {
+            int32_t offsets [LANES];
+            for (size_t j = 0; j < LANES; j++) offsets [j] = (int32_t) ((4 * j + k) * NUM_TIMESLOTS);
+            memcpy (&index [k], offsets, sizeof (V));
+            for (size_t shift = 0; shift < 4; shift++) {
+                byte mask [FRAMES];
+                for (size_t i = 0; i < FRAMES; i++) {
+                    mask [i] = i % 4 == k ? (byte) (i % 16 / 4 * 4 + shift) : 0x80;
+                }
+                memcpy (&pack [shift][k], mask, sizeof (V));
+            }
+        }
+    }
+
+    void demux (const byte * src, size_t src_length, byte ** dst) const
+    {
+        assert (src_length == NUM_TIMESLOTS * DST_SIZE);
+
+        for (uint32_t mask = timeslots; mask; mask &= mask - 1) {
+            size_t t = __builtin_ctz (mask);
+            size_t start = min (t, NUM_TIMESLOTS - 4);
+            const V * p = pack [t - start];
+            byte * d = dst [t];
+            for (size_t f = 0; f < DST_SIZE; f += FRAMES) {
+                const byte * base = src + f * NUM_TIMESLOTS + start;
+                V r = or_v (or_v (shuffle (gather (index [0], base), p [0]), shuffle (gather (index [1], base), p [1])),
+                            or_v (shuffle (gather (index [2], base), p [2]), shuffle (gather (index [3], base), p [3])));
+                memcpy (d + f, &r, sizeof (V));
+            }
+        }
+    }
+};
+
+/** Demultiplexes the selected timeslots with Gather_Select if there are at most crossover of them,
+  * otherwise with a full transposition (Read32_Write32_AVX2_Unpack_Unroll), whose output for the other
+  * timeslots goes to a scratch block.
+  */
+class Select_Demux : public Demux
+{
+    const Gather_Select gather;
+    const Read32_Write32_AVX2_Unpack_Unroll full;
+    const uint32_t timeslots;
+    const bool use_gather;
+    byte * scratch;
+
+public:
+    Select_Demux (uint32_t timeslots, size_t crossover)
+        : gather (timeslots), timeslots (timeslots), use_gather ((size_t) __builtin_popcount (timeslots) <= crossover)
+    {
+        scratch = (byte *) _mm_malloc (NUM_TIMESLOTS * DST_SIZE, 64);
+    }
+
+    ~Select_Demux ()
+    {
+        _mm_free (scratch);
+    }
+
+    bool gathers () const
+    {
+        return use_gather;
+    }
+
+    void demux (const byte * src, size_t src_length, byte ** dst) const
+    {
+        if (use_gather) {
+            gather.demux (src, src_length, dst);
+            return;
+        }
+        byte * d [NUM_TIMESLOTS];
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            d [i] = (timeslots >> i & 1) ? dst [i] : scratch + i * DST_SIZE;
+        }
+        full.demux (src, src_length, d);
+    }
+};
+
+static const unsigned CALIBRATION_ITERATIONS = 100000;
+static const unsigned CALIBRATION_REPEATS = 5;
+
+/** @return time, in time stamp counter ticks, of CALIBRATION_ITERATIONS calls: the best of CALIBRATION_REPEATS runs,
+  * so that a run disturbed by an interrupt or another thread does not move the crossover
+  */
+uint64_t calibrate (const Demux & demux, const byte * src, byte ** dst)
+{
+    uint64_t best = ~ (uint64_t) 0;
+    for (unsigned r = 0; r < CALIBRATION_REPEATS; r++) {
+        uint64_t t0 = timestamp ();
+        for (unsigned i = 0; i < CALIBRATION_ITERATIONS; i++) {
+            demux.demux (src, SRC_SIZE, dst);
+        }
+        best = min (best, timestamp () - t0);
+    }
+    return best;
+}
+
+/** Finds, once, the largest number of timeslots for which Gather_Select is faster than the full transposition
+  * on this host. The gathers are timed for 1, 2, 3 ... timeslots until they are no longer faster: their cost
+  * is not linear enough in the number of timeslots to be extrapolated from one and all of them.
+  * The full transposition is timed again after every count, so both sides see the same state of the host.
+  * The gathers must be faster by 5%: near the crossover the two are within the noise, and a tie goes to the full
+  * transposition, whose cost does not depend on the selection.
+  */
+size_t gather_crossover ()
+{
+    static size_t crossover = NUM_TIMESLOTS + 1;
+    if (crossover <= NUM_TIMESLOTS) return crossover;
+
+    byte * src = (byte *) _mm_malloc (SRC_SIZE, 64);
+    byte * data = (byte *) _mm_malloc (SRC_SIZE, 64);
+    byte * dst [NUM_TIMESLOTS];
+    memset (src, 0x55, SRC_SIZE);
+    for (size_t i = 0; i < NUM_TIMESLOTS; i++) dst [i] = data + i * DST_SIZE;
+
+    const Read32_Write32_AVX2_Unpack_Unroll full;
+    uint64_t t_full = calibrate (full, src, dst);
+    size_t n = 0;
+    while (n < NUM_TIMESLOTS) {
+        uint64_t t = calibrate (Gather_Select ((uint32_t) ((2ULL << n) - 1)), src, dst);     // n + 1 timeslots
+        t_full = min (t_full, calibrate (full, src, dst));
+        if (t * 20 >= t_full * 19) break;
+        n ++;
+    }
+    crossover = n;
+
+    _mm_free (src);
+    _mm_free (data);
+    return crossover;
+}
+
+// ------- Bit-reversed timeslots
+
+// Some framers deliver every timeslot byte with the bits in reverse order (LSB first). The bits are put back
+// in the registers right after the transposition, instead of in another pass over the channel buffers.
+
+/** A transposition policy for Block_16x16 and Block_32x32: transposition T followed by reverse_bits */
+template<class T> struct Bit_Reversed
+{
+    template<class V> static ALWAYS_INLINE void transpose (V (&x) [16])
+    {
+        T::transpose (x);
+        unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA { x [i] = reverse_bits (x [i]); });
+    }
+};
+
+class Read16_Write16_SSE_Reverse_Unroll : public Unrolled<Block_16x16<Bit_Reversed<Shuffle_16x16>>> {};
+class Read32_Write32_AVX2_Reverse_Unroll : public Unrolled<Block_32x32<Bit_Reversed<Unpack_16x16>>> {};
+
+/** Expands 32 A-law bytes into 32 linear 16-bit samples (the same values as alaw_to_linear below).
+  * The work is done on bytes, where one instruction covers 32 samples: PSHUFB turns the segment into
+  * the multiplier (1 << (seg - 1), or 1 for segment 0) and into the high byte of the bias (0x108, or 8 for
+  * segment 0), and the unpacks make words of them; only the multiplication and the sign are done on words.
+  */
+ALWAYS_INLINE void alaw_expand (__m256i a, __m256i & lo, __m256i & hi)
+{
+    const __m256i mult_table = _mm256_broadcastsi128_si256 (_mm_setr_epi8 (1, 1, 2, 4, 8, 16, 32, 64, 0, 0, 0, 0, 0, 0, 0, 0));
+    const __m256i bias_table = _mm256_broadcastsi128_si256 (_mm_setr_epi8 (0, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0));
+    const __m256i zero = _mm256_setzero_si256 ();
+    const __m256i one = _mm256_set1_epi8 (1);
+
+    a = _mm256_permute4x64_epi64 (a, 0xD8);     // so that the unpacks make words of samples 0-15 and 16-31
+    __m256i x = _mm256_xor_si256 (a, _mm256_set1_epi8 (0x55));
+    __m256i seg = _mm256_and_si256 (_mm256_srli_epi16 (x, 4), _mm256_set1_epi8 (7));
+    __m256i mult = _mm256_shuffle_epi8 (mult_table, seg);
+    __m256i bias = _mm256_shuffle_epi8 (bias_table, seg);
+    __m256i m = _mm256_or_si256 (_mm256_and_si256 (_mm256_slli_epi16 (x, 4), _mm256_set1_epi8 ((char) 0xF0)),
+                                 _mm256_set1_epi8 (8));
+    // the sign bit set means positive: PSIGNW negates the words where the inverted bit makes the high byte negative
+    __m256i sign = _mm256_xor_si256 (a, _mm256_set1_epi8 ((char) 0xAA));
+
+    lo = _mm256_sign_epi16 (_mm256_mullo_epi16 (_mm256_unpacklo_epi8 (m, bias), _mm256_unpacklo_epi8 (mult, zero)),
+                            _mm256_unpacklo_epi8 (one, sign));
+    hi = _mm256_sign_epi16 (_mm256_mullo_epi16 (_mm256_unpackhi_epi8 (m, bias), _mm256_unpackhi_epi8 (mult, zero)),
+                            _mm256_unpackhi_epi8 (one, sign));
+}
+
+/** Demultiplexes A-law timeslots straight into linear 16-bit samples, reversing the bits of every byte first
+  * if REVERSE is set. It uses the blocks of Read32_Write32_AVX2_Unpack_Unroll; each output row of 32 bytes is
+  * expanded in registers into 64 bytes. The outputs must be aligned to 32 bytes.
+  */
+template<bool REVERSE> class Read32_Write32_AVX2_Linear
+{
+public:
+    void demux (const byte * src, size_t src_length, int16_t ** dst) const
+    {
+        static_assert (NUM_TIMESLOTS == 32, "the block is 32 timeslots wide");
+        static_assert (DST_SIZE % 32 == 0, "the block size must be a multiple of 32");
+        assert (src_length == NUM_TIMESLOTS * DST_SIZE);
+
+        unroll<DST_SIZE / 32> ([&] (auto n) ALWAYS_INLINE_LAMBDA {
+            __m256i w [16], v [16];
+            Block_32x32_AVX2_Unpack::transpose (&src [n * 32 * NUM_TIMESLOTS], NUM_TIMESLOTS, w, v);
+            unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA {
+                store (&dst [i][n * 32], _mm256_permute2x128_si256 (w [i], v [i], 0x20));
+                store (&dst [16 + i][n * 32], _mm256_permute2x128_si256 (w [i], v [i], 0x31));
+            });
+        });
+    }
+
+private:
+    static ALWAYS_INLINE void store (int16_t * d, __m256i x)
+    {
+        __m256i lo, hi;
+        alaw_expand (REVERSE ? reverse_bits (x) : x, lo, hi);
+        _mm256_store_si256 ((__m256i *) d, lo);
+        _mm256_store_si256 ((__m256i *) (d + 16), hi);
+    }
+};
+
+#endif
+
+// ------- Tone detection on demultiplexed channels
+
+/** Converts A-law byte into linear value (ITU-T G.711); the result is in the range -32256..32256 */
+inline int alaw_to_linear (byte a)
+{
+    a ^= 0x55;
+    int t = (a & 0x0F) << 4;
+    int seg = (a & 0x70) >> 4;
+    if (seg == 0) {
+        t += 8;
+    } else {
+        t = (t + 0x108) << (seg - 1);
+    }
+    return (a & 0x80) ? t : -t;
+}
+
+/** Converts linear value in the range -32768..32767 into A-law byte (ITU-T G.711) */
+inline byte linear_to_alaw (int x)
+{
+    int mask = x >= 0 ? 0xD5 : 0x55;
+    if (x < 0) x = -x - 1;
+    if (x > 32767) x = 32767;
+    int seg = 0;
+    while (seg < 8 && x > (0xFF << seg)) seg ++;
+    if (seg >= 8) return (byte) (0x7F ^ mask);
+    int a = seg << 4;
+    a |= seg < 2 ? (x >> 4) & 0x0F : (x >> (seg + 3)) & 0x0F;
+    return (byte) (a ^ mask);
+}
+
+static float alaw_table [256];
+
+static const size_t NUM_TONES = 8;
+static const float SAMPLE_RATE = 8000;
+static const float DTMF_FREQ [NUM_TONES] = {697, 770, 852, 941, 1209, 1336, 1477, 1633};
+static const char DTMF_DIGITS [4][4] = {{'1', '2', '3', 'A'},
+                                         {'4', '5', '6', 'B'},
+                                         {'7', '8', '9', 'C'},
+                                         {'*', '0', '#', 'D'}};
+
+/** Goertzel filter state for all tones of all timeslots, and the DTMF decision made at the end of a window.
+  * The window is a whole number of demultiplexed blocks: 192 samples (24 ms, 41.7 Hz resolution) by default.
+  * A digit is reported when the strongest row and column tones both carry a significant part of the energy
+  * of the timeslot; for a pure DTMF signal each of them carries a half.
+  */
+class Goertzel_State
+{
+protected:
+    float coeff [NUM_TONES];
+    float s1 [NUM_TONES][NUM_TIMESLOTS];
+    float s2 [NUM_TONES][NUM_TIMESLOTS];
+    float energy [NUM_TIMESLOTS];
+    char digits [NUM_TIMESLOTS];
+    const size_t window;
+    size_t samples;
+
+    Goertzel_State (size_t window) : window (window), samples (0)
+    {
+        assert (window % DST_SIZE == 0);
+        for (size_t i = 0; i < 256; i++) alaw_table [i] = (float) alaw_to_linear ((byte) i);
+        for (size_t k = 0; k < NUM_TONES; k++) coeff [k] = (float) (2 * cos (2 * M_PI * DTMF_FREQ [k] / SAMPLE_RATE));
+        reset ();
+        memset (digits, 0, sizeof (digits));
+    }
+
+    void reset ()
+    {
+        memset (s1, 0, sizeof (s1));
+        memset (s2, 0, sizeof (s2));
+        memset (energy, 0, sizeof (energy));
+        samples = 0;
+    }
+
+    /** Accounts for a processed block; makes the decision and returns true at the end of a window */
+    bool next_block ()
+    {
+        samples += DST_SIZE;
+        if (samples < window) return false;
+
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            float power [NUM_TONES];
+            for (size_t k = 0; k < NUM_TONES; k++) {
+                power [k] = s1 [k][i] * s1 [k][i] + s2 [k][i] * s2 [k][i] - coeff [k] * s1 [k][i] * s2 [k][i];
+            }
+            size_t row = 0, col = 4;
+            for (size_t k = 1; k < 4; k++) {
+                if (power [k] > power [row]) row = k;
+                if (power [k + 4] > power [col]) col = k + 4;
+            }
+            float scale = energy [i] == 0 ? 0 : 2 / (window * energy [i]);
+            float r = power [row] * scale;
+            float c = power [col] * scale;
+            digits [i] = r > 0.25f && c > 0.25f && r + c > 0.7f ? DTMF_DIGITS [row][col - 4] : 0;
+        }
+        reset ();
+        return true;
+    }
+
+public:
+    /** The digit detected in the timeslot in the last complete window, or 0 */
+    char digit (size_t timeslot) const
+    {
+        return digits [timeslot];
+    }
+};
+
+/** Scalar tone detector: runs the filters on each demultiplexed channel in turn */
+class Goertzel : public Goertzel_State
+{
+public:
+    Goertzel (size_t window = 3 * DST_SIZE) : Goertzel_State (window) {}
+
+    bool process (byte ** dst, uint32_t active = 0xFFFFFFFF)
+    {
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            if (! (active >> i & 1)) continue;
+            const byte * d = dst [i];
+            float a [NUM_TONES], b [NUM_TONES];
+            float e = energy [i];
+            for (size_t k = 0; k < NUM_TONES; k++) {
+                a [k] = s1 [k][i];
+                b [k] = s2 [k][i];
+            }
+            for (size_t n = 0; n < DST_SIZE; n++) {
+                float x = alaw_table [d [n]];
+                e += x * x;
+                for (size_t k = 0; k < NUM_TONES; k++) {
+                    float s = x + coeff [k] * a [k] - b [k];
+                    b [k] = a [k];
+                    a [k] = s;
+                }
+            }
+            for (size_t k = 0; k < NUM_TONES; k++) {
+                s1 [k][i] = a [k];
+                s2 [k][i] = b [k];
+            }
+            energy [i] = e;
+        }
+        return next_block ();
+    }
+};
+
+#ifdef __AVX2__
+
+/** AVX2 tone detector: runs the filters on eight channels at once, one channel per lane.
+  * Only active timeslots are processed: they are packed into consecutive lanes. Sixteen samples of each of
+  * the eight channels are read with contiguous loads from the demultiplexed channel buffers and transposed
+  * back into lanes with unpacks, and then expanded from A-law with alaw_expand, so there are no gathers
+  * in the sample loop; only the filter state is gathered and scattered, once per block.
+  */
+class Goertzel_AVX : public Goertzel_State
+{
+public:
+    Goertzel_AVX (size_t window = 3 * DST_SIZE) : Goertzel_State (window) {}
+
+    bool process (byte ** dst, uint32_t active = 0xFFFFFFFF)
+    {
+        assert (NUM_TIMESLOTS <= 32);
+
+        int32_t lanes [NUM_TIMESLOTS + 8];
+        size_t count = 0;
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            if (active >> i & 1) lanes [count ++] = (int32_t) i;
+        }
+        if (count != 0) {
+            // Padding lanes repeat the last active timeslot; their results are discarded
+            for (size_t i = count; i % 8 != 0; i++) lanes [i] = lanes [count - 1];
+            for (size_t g = 0; g < count; g += 8) {
+                process_group (dst, &lanes [g], count - g < 8 ? count - g : 8);
+            }
+        }
+        return next_block ();
+    }
+
+private:
+    static void scatter (float * p, const int32_t * lanes, size_t count, __m256 v)
+    {
+        float t [8];
+        _mm256_storeu_ps (t, v);
+        for (size_t i = 0; i < count; i++) p [lanes [i]] = t [i];
+    }
+
+    static ALWAYS_INLINE __m256 to_float (__m128i words)
+    {
+        return _mm256_cvtepi32_ps (_mm256_cvtepi16_epi32 (words));
+    }
+
+    /** Loads samples n .. n + 15 of eight channels: x [j] gets sample n + j of channel i in lane i */
+    static ALWAYS_INLINE void load_samples (const byte * const * d, size_t n, __m256 * x)
+    {
+        // t [k]: samples 0-7 | 8-15 of channels 2k and 2k + 1, interleaved
+        __m256i t [4];
+        unroll<4> ([&] (auto k) ALWAYS_INLINE_LAMBDA {
+            __m128i a = _mm_loadu_si128 ((const __m128i *) &d [2 * k][n]);
+            __m128i b = _mm_loadu_si128 ((const __m128i *) &d [2 * k + 1][n]);
+            t [k] = _mm256_inserti128_si256 (_mm256_castsi128_si256 (_mm_unpacklo_epi8 (a, b)), _mm_unpackhi_epi8 (a, b), 1);
+        });
+        // u0, u1: samples 0-3 | 8-11 and 4-7 | 12-15 of channels 0-3; u2, u3: the same of channels 4-7
+        __m256i u0 = _mm256_unpacklo_epi16 (t [0], t [1]);
+        __m256i u1 = _mm256_unpackhi_epi16 (t [0], t [1]);
+        __m256i u2 = _mm256_unpacklo_epi16 (t [2], t [3]);
+        __m256i u3 = _mm256_unpackhi_epi16 (t [2], t [3]);
+        // v [j]: samples 2j, 2j + 1 | 8 + 2j, 9 + 2j of all the channels
+        __m256i v [4] = {_mm256_unpacklo_epi32 (u0, u2), _mm256_unpackhi_epi32 (u0, u2),
+                         _mm256_unpacklo_epi32 (u1, u3), _mm256_unpackhi_epi32 (u1, u3)};
+        unroll<4> ([&] (auto j) ALWAYS_INLINE_LAMBDA {
+            __m256i lo, hi;
+            alaw_expand (v [j], lo, hi);
+            x [2 * j] = to_float (_mm256_castsi256_si128 (lo));
+            x [2 * j + 1] = to_float (_mm256_extracti128_si256 (lo, 1));
+            x [8 + 2 * j] = to_float (_mm256_castsi256_si128 (hi));
+            x [9 + 2 * j] = to_float (_mm256_extracti128_si256 (hi, 1));
+        });
+    }
+
+    void process_group (byte * const * dst, const int32_t * lanes, size_t count)
+    {
+        static_assert (DST_SIZE % 16 == 0, "samples are loaded sixteen at a time");
+        const __m256i index = _mm256_loadu_si256 ((const __m256i *) lanes);
+        const byte * d [8];
+        for (size_t i = 0; i < 8; i++) d [i] = dst [lanes [i]];
+
+        __m256 x [DST_SIZE];
+        for (size_t n = 0; n < DST_SIZE; n += 16) {
+            load_samples (d, n, &x [n]);
+        }
+        __m256 e = _mm256_i32gather_ps (energy, index, 4);
+        for (size_t n = 0; n < DST_SIZE; n++) {
+            e = _mm256_add_ps (e, _mm256_mul_ps (x [n], x [n]));
+        }
+        scatter (energy, lanes, count, e);
+
+        // Four tones at a time: four independent dependency chains, and all the state fits in registers
+        for (size_t k0 = 0; k0 < NUM_TONES; k0 += 4) {
+            __m256 c [4], a [4], b [4];
+            for (size_t k = 0; k < 4; k++) {
+                c [k] = _mm256_set1_ps (coeff [k0 + k]);
+                a [k] = _mm256_i32gather_ps (s1 [k0 + k], index, 4);
+                b [k] = _mm256_i32gather_ps (s2 [k0 + k], index, 4);
+            }
+            for (size_t n = 0; n < DST_SIZE; n++) {
+                for (size_t k = 0; k < 4; k++) {
+                    __m256 s = _mm256_add_ps (_mm256_sub_ps (x [n], b [k]), _mm256_mul_ps (c [k], a [k]));
+                    b [k] = a [k];
+                    a [k] = s;
+                }
+            }
+            for (size_t k = 0; k < 4; k++) {
+                scatter (s1 [k0 + k], lanes, count, a [k]);
+                scatter (s2 [k0 + k], lanes, count, b [k]);
+            }
+        }
+    }
+};
+
+#endif
+
+// ------- Output to ring buffers
+
+/** Demultiplexes a block directly into the ring buffers, and publishes it to the consumers with one store.
+  * @return false if some ring does not have space for the block; nothing is written then
+  */
+bool demux_to_rings (const Demux & demux, const byte * src, size_t src_length, Ring_Set & rings)
+{
+    byte * d [NUM_TIMESLOTS];
+    if (! rings.acquire (d)) return false;
+    demux.demux (src, src_length, d);
+    rings.publish ();
+    return true;
+}
+
+// ------- Output to shared memory
+
+#ifdef __linux__
+/** Demultiplexes a block into the next slot of the shared memory plane and publishes it */
+void demux_to_plane (const Demux & demux, const byte * src, size_t src_length, Shm_Plane & plane)
+{
+    byte * d [NUM_TIMESLOTS];
+    plane.acquire (d);
+    demux.demux (src, src_length, d);
+    plane.publish ();
+}
+#endif
+
+// ------- Incremental demultiplexing
+
+/** Demultiplexes a stream that arrives a few frames at a time, for low latency.
+  * Frames are collected in an 8-frame staging block. Whenever it is full, it is transposed in registers,
+  * and every timeslot receives 8 bytes with one 64-bit store. So the output lags the input by at most
+  * 7 frames (875 us), rather than by up to 63 frames (7.9 ms) when waiting for a block for Demux::demux.
+  * Eight or more frames arriving at once are transposed straight from the input.
+  * flush() makes the frames in the staging block visible immediately.
+  */
+class Incremental_Demux
+{
+    static const size_t STAGE = 8;
+
+    alignas (16) byte staging [STAGE * NUM_TIMESLOTS];
+    byte * const * dst;
+    size_t capacity;
+    size_t dst_pos;
+    size_t staged;
+
+    void transpose (const byte * frames)
+    {
+        for (size_t dst_num = 0; dst_num < NUM_TIMESLOTS; dst_num += 16) {
+#define LOADROW(i) _mm_loadu_si128 ((const __m128i *) &frames [i * NUM_TIMESLOTS + dst_num])
+            transpose_8x16_store (LOADROW (0), LOADROW (1), LOADROW (2), LOADROW (3),
+                                  LOADROW (4), LOADROW (5), LOADROW (6), LOADROW (7),
+                                  dst + dst_num, dst_pos);
+#undef LOADROW
+        }
+        dst_pos += STAGE;
+    }
+
+    /** Copies frames into the staging block; faster than a memcpy of variable size for one or two frames */
+    void stage (const byte * src, size_t frames)
+    {
+        byte * p = staging + staged * NUM_TIMESLOTS;
+        for (size_t i = 0; i < frames * NUM_TIMESLOTS; i += 16) {
+            _128i_store (p + i, _mm_loadu_si128 ((const __m128i *) (src + i)));
+        }
+        staged += frames;
+    }
+
+public:
+    /** @param dst       NUM_TIMESLOTS output buffers
+      * @param capacity  size of each output buffer
+      */
+    Incremental_Demux (byte * const * dst, size_t capacity) : dst (dst), capacity (capacity), dst_pos (0), staged (0)
+    {
+        assert (NUM_TIMESLOTS % 16 == 0);
+    }
+
+    /** Accepts a number of whole frames */
+    void write (const byte * src, size_t frames)
+    {
+        assert (dst_pos + staged + frames <= capacity);
+
+        if (staged != 0) {
+            size_t n = min (STAGE - staged, frames);
+            stage (src, n);
+            src += n * NUM_TIMESLOTS;
+            frames -= n;
+            if (staged < STAGE) return;
+            transpose (staging);
+            staged = 0;
+        }
+        for (; frames >= STAGE; frames -= STAGE, src += STAGE * NUM_TIMESLOTS) {
+            transpose (src);
+        }
+        stage (src, frames);
+    }
+
+    /** Writes the staged frames to the output straight away */
+    void flush ()
+    {
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            for (size_t j = 0; j < staged; j++) {
+                dst [i][dst_pos + j] = staging [j * NUM_TIMESLOTS + i];
+            }
+        }
+        dst_pos += staged;
+        staged = 0;
+    }
+
+    /** @return the number of bytes written to each output buffer */
+    size_t position () const
+    {
+        return dst_pos;
+    }
+
+    /** Starts writing from the beginning of the output buffers again; the staged frames are kept */
+    void rewind ()
+    {
+        dst_pos = 0;
+    }
+};
+
+// ------- Batches of blocks
+
+/** Demultiplexes many consecutive blocks per call, so a kernel chosen at run time costs one virtual call
+  * per batch rather than one per block
+  */
+class Batch_Demux
+{
+public:
+    /** Demultiplexes blocks consecutive source blocks; block j goes to dst [i] + j * DST_SIZE */
+    virtual void demux_blocks (const byte * src, size_t blocks, byte * const * dst) const = 0;
+
+protected:
+    /** The loop of demux_blocks: calls kernel (block source, block outputs) for every block */
+    template<class F>
+    static ALWAYS_INLINE void for_each_block (const byte * src, size_t blocks, byte * const * dst, F kernel)
+    {
+        byte * d [NUM_TIMESLOTS];
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            d [i] = dst [i];
+        }
+        for (size_t j = 0; j < blocks; j++) {
+            kernel (src + j * SRC_SIZE, d);
+            for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+                d [i] += DST_SIZE;
+            }
+        }
+    }
+};
+
+/** Batch_Demux for a kernel known at compile time. The calls of K::demux are bound statically
+  * (a qualified call is never virtual), so the kernel can be inlined into the loop.
+  */
+template<class K> class Static_Batch : public Batch_Demux
+{
+    const K kernel;
+
+public:
+    Static_Batch (const K & kernel = K ()) : kernel (kernel) {}
+
+    void demux_blocks (const byte * src, size_t blocks, byte * const * dst) const
+    {
+        for_each_block (src, blocks, dst, [this] (const byte * s, byte ** d) ALWAYS_INLINE_LAMBDA {
+            kernel.K::demux (s, SRC_SIZE, d);
+        });
+    }
+};
+
+/** Batch_Demux for any Demux, calling it through the virtual table for every block */
+class Dynamic_Batch : public Batch_Demux
+{
+    const Demux & demux;
+
+public:
+    Dynamic_Batch (const Demux & demux) : demux (demux) {}
+
+    void demux_blocks (const byte * src, size_t blocks, byte * const * dst) const
+    {
+        for_each_block (src, blocks, dst, [this] (const byte * s, byte ** d) ALWAYS_INLINE_LAMBDA {
+            demux.demux (s, SRC_SIZE, d);
+        });
+    }
+};
+
+// ------- Parallel demultiplexing of a large buffer
+
+static const size_t PARALLEL_CHUNK_BLOCKS = 64;    // 128K of source and 128K of output: a chunk fits in L2
+
+/** Demultiplexes a large buffer on several threads. The source is split along the frames into chunks of
+  * PARALLEL_CHUNK_BLOCKS blocks, which the threads take in turn from a shared counter. Every chunk is
+  * written straight into its place in the channel outputs, so the threads never need to merge anything.
+  * @param blocks   number of blocks in src
+  * @param dst      channel outputs, blocks * DST_SIZE bytes each
+  * @param threads  number of threads; the calling thread is one of them
+  */
+void parallel_demux (const Batch_Demux & demux, const byte * src, size_t blocks, byte * const * dst, unsigned threads)
+{
+    const size_t chunks = (blocks + PARALLEL_CHUNK_BLOCKS - 1) / PARALLEL_CHUNK_BLOCKS;
+    atomic<size_t> next (0);
+
+    auto work = [&] () {
+        byte * d [NUM_TIMESLOTS];
+        for (size_t c; (c = next.fetch_add (1, memory_order_relaxed)) < chunks; ) {
+            size_t first = c * PARALLEL_CHUNK_BLOCKS;
+            for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+                d [i] = dst [i] + first * DST_SIZE;
+            }
+            demux.demux_blocks (src + first * SRC_SIZE, min (PARALLEL_CHUNK_BLOCKS, blocks - first), d);
+        }
+    };
+
+    vector<thread> workers;
+    for (unsigned i = 1; i < threads; i++) {
+        workers.push_back (thread (work));
+    }
+    work ();
+    for (size_t i = 0; i < workers.size (); i++) {
+        workers [i].join ();
+    }
+}
+
+// ------- Streaming
+
+/** The kernel of the streaming tools (frame alignment, file and pipeline demultiplexing): the fastest one that
+  * the build allows (the AVX2 one, the SSE one, or the unrolled scalar one where SSE4.1 is not available)
+  */
+#ifdef __AVX2__
+typedef Read32_Write32_AVX2_Unpack_Unroll Stream_Kernel;
+#elif defined (__SSE4_1__)
+typedef Read16_Write16_SSE_Unroll Stream_Kernel;
+#else
+typedef Read8_Write8_Unroll Stream_Kernel;
+#endif
+
+/** Receives the output of Stream_Demux */
+class Channel_Sink
+{
+public:
+    /** Called when the output buffers are full, and at the end of the stream.
+      * The sink may keep the buffers, replacing the pointers in channels with other buffers of the same capacity,
+      * allocated with _mm_malloc; Stream_Demux continues with those buffers (and frees the ones it has at the end).
+      * @param channels  NUM_TIMESLOTS buffers
+      * @param length    number of bytes in each buffer
+      */
+    virtual void write (byte ** channels, size_t length) = 0;
+
+    /** Called when Stream_Demux monitoring the frame alignment finds the frame boundary: at the start of the stream
+      * and after every loss of alignment (a slip or a corrupted stretch of the link). The output that follows
+      * starts at the new boundary.
+      * @param dropped  number of bytes of the stream since the last correctly aligned frame that were not demultiplexed
+      */
+    virtual void realigned (size_t /* dropped */)
+    {
+    }
+};
+
+/** Frame alignment signal of G.704, bits 2-8 of TS0 in even frames (bit 1, Si, is not part of it) */
+static const byte FAS = 0x1B;
+static const byte FAS_MASK = 0x7F;
+
+/** Bit 2 of TS0 in odd frames, which is always 1 there (and 0 in the FAS) */
+static const byte NFAS_BIT = 0x40;
+
+/** Number of consecutive FAS received in error after which the alignment is considered lost (G.706) */
+static const unsigned FAS_ERRORS_LOST = 3;
+
+/** Default size of every channel buffer of Stream_Demux: the sink is called every 1024 blocks */
+static const size_t STREAM_CAPACITY = 1024 * DST_SIZE;
+
+/** Demultiplexes a stream of any length, delivered in pieces of any size, using a block kernel.
+  * The kernel writes straight into per-timeslot output buffers, which are passed to the sink when they are full,
+  * so the sink sees few large writes. An incomplete block is kept until the next piece arrives; the same buffer
+  * is used to align blocks when a piece does not start at a 32-byte boundary (the kernels use aligned loads).
+  *
+  * Optionally the frame alignment is monitored. The FAS is checked in the TS0 output of every block, which the kernel
+  * has just written, with two vector compares per block, so the monitoring costs almost nothing while the link is
+  * aligned, and isolated bit errors cost nothing at all (the alignment is lost after three consecutive errored FAS).
+  * When it is lost, the output of the block is discarded and the boundary is searched for, byte by byte, starting
+  * from the first errored FAS: a FAS, a NFAS bit one frame later, and a FAS again two frames later. From the new
+  * boundary the stream goes back to the kernels, so a slip costs one block of output and a few frames of hunting,
+  * not a restart of the stream. With the monitoring on, the output starts at the first frame boundary of the stream.
+  */
+class Stream_Demux
+{
+    const Batch_Demux & demux;
+    Channel_Sink & sink;
+    const size_t capacity;
+    const bool monitor;
+    byte ** out;
+    size_t out_pos;
+    byte * pending;
+    size_t pending_length;
+
+    bool aligned;
+    unsigned fas_errors;        // consecutive errored FAS up to the end of the last block
+    byte * hunt_buffer;
+    size_t hunt_length;
+    size_t dropped;
+    size_t losses;
+
+    static const size_t HUNT_SIZE = SRC_SIZE;
+    static const size_t HUNT_WINDOW = 2 * NUM_TIMESLOTS + 1;     // FAS, NFAS, FAS
+
+    /** Checks the FAS in TS0 of a demultiplexed block; the block starts with a FAS frame
+      * @return DST_SIZE if the alignment holds, otherwise the frame to search for the new alignment from:
+      *         the first of the errored FAS that caused the loss (0 if the errors started in the previous block)
+      */
+    size_t check_fas (const byte * ts0)
+    {
+        static_assert (DST_SIZE % 32 == 0, "DST_SIZE must be a multiple of 32");
+#ifdef __AVX2__
+        const __m256i mask = _mm256_set1_epi16 (FAS_MASK);
+        const __m256i fas = _mm256_set1_epi16 (FAS);
+#endif
+        for (size_t f = 0; f < DST_SIZE; f += 32) {
+#ifdef __AVX2__
+            __m256i x = _mm256_and_si256 (_mm256_load_si256 ((const __m256i *) (ts0 + f)), mask);
+            uint32_t errors = ~ (uint32_t) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (x, fas)) & 0x55555555;
+#else
+            uint32_t errors = 0;
+            for (size_t j = 0; j < 32; j += 2) {
+                if ((ts0 [f + j] & FAS_MASK) != FAS) errors |= 1u << j;
+            }
+#endif
+            if (errors == 0) {
+                fas_errors = 0;
+                continue;
+            }
+            for (size_t j = 0; j < 32; j += 2) {
+                if ((errors >> j & 1) == 0) {
+                    fas_errors = 0;
+                } else if (++ fas_errors == FAS_ERRORS_LOST) {
+                    size_t frame = f + j;
+                    return frame >= 2 * (FAS_ERRORS_LOST - 1) ? frame - 2 * (FAS_ERRORS_LOST - 1) : 0;
+                }
+            }
+        }
+        return DST_SIZE;
+    }
+
+    /** Demultiplexes up to count blocks, as many as fit into the output buffers
+      * @return the number of bytes processed: a multiple of SRC_SIZE, or, if the alignment is lost,
+      *         the offset from which to search for the new one
+      */
+    size_t blocks (const byte * src, size_t count)
+    {
+        count = min (count, (capacity - out_pos) / DST_SIZE);
+        byte * d [NUM_TIMESLOTS];
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            d [i] = out [i] + out_pos;
+        }
+        demux.demux_blocks (src, count, d);
+        if (monitor) {
+            for (size_t b = 0; b < count; b++) {
+                size_t frame = check_fas (out [0] + out_pos + b * DST_SIZE);
+                if (frame != DST_SIZE) {
+                    out_pos += b * DST_SIZE;
+                    aligned = false;
+                    fas_errors = 0;
+                    ++ losses;
+                    dropped = frame * NUM_TIMESLOTS;
+                    return b * SRC_SIZE + frame * NUM_TIMESLOTS;
+                }
+            }
+        }
+        out_pos += count * DST_SIZE;
+        if (out_pos == capacity) flush ();
+        return count * SRC_SIZE;
+    }
+
+    void flush ()
+    {
+        if (out_pos != 0) sink.write (out, out_pos);
+        out_pos = 0;
+    }
+
+    /** Searches for the frame boundary in the bytes collected so far and the new ones.
+      * Once found, the rest of the collected bytes is demultiplexed.
+      * @return the number of bytes of data consumed
+      */
+    size_t hunt (const byte * data, size_t length)
+    {
+        size_t n = min (length, HUNT_SIZE - hunt_length);
+        memcpy (hunt_buffer + hunt_length, data, n);
+        hunt_length += n;
+        const size_t T = NUM_TIMESLOTS;
+        size_t o;
+        for (o = 0; o + HUNT_WINDOW <= hunt_length; o++) {
+            const byte * p = hunt_buffer + o;
+            if ((p [0] & FAS_MASK) == FAS && (p [T] & NFAS_BIT) && (p [2 * T] & FAS_MASK) == FAS) {
+                aligned = true;
+                sink.realigned (dropped + o);
+                dropped = 0;
+                size_t rest = hunt_length - o;
+                hunt_length = 0;
+                byte replay [HUNT_SIZE];
+                memcpy (replay, p, rest);
+                write (replay, rest);
+                return n;
+            }
+        }
+        dropped += o;
+        memmove (hunt_buffer, hunt_buffer + o, hunt_length - o);
+        hunt_length -= o;
+        return n;
+    }
+
+    /** Demultiplexes aligned data
+      * @return the number of bytes of data consumed: all of them, unless the alignment is lost
+      */
+    size_t write_aligned (const byte * data, size_t length)
+    {
+        size_t consumed = 0;
+        if (pending_length != 0) {
+            size_t n = min (SRC_SIZE - pending_length, length);
+            memcpy (pending + pending_length, data, n);
+            pending_length += n;
+            data += n;
+            length -= n;
+            consumed = n;
+            if (pending_length < SRC_SIZE) return consumed;
+            pending_length = 0;
+            size_t done = blocks (pending, 1);
+            if (done != SRC_SIZE) {
+                // the search starts in the bytes of the previous pieces, which are only here
+                byte rest [SRC_SIZE];
+                memcpy (rest, pending + done, SRC_SIZE - done);
+                write (rest, SRC_SIZE - done);
+                return consumed;
+            }
+        }
+        if (((uintptr_t) data & 31) == 0) {
+            while (length >= SRC_SIZE) {
+                size_t n = blocks (data, length / SRC_SIZE);
+                data += n;
+                length -= n;
+                consumed += n;
+                if (! aligned) return consumed;
+            }
+        } else {
+            while (length >= SRC_SIZE) {
+                memcpy (pending, data, SRC_SIZE);
+                size_t n = blocks (pending, 1);
+                data += n;
+                length -= n;
+                consumed += n;
+                if (! aligned) return consumed;
+            }
+        }
+        memcpy (pending, data, length);
+        pending_length = length;
+        return consumed + length;
+    }
+
+public:
+    /** @param capacity  size of each output buffer, a multiple of DST_SIZE
+      * @param monitor   monitor the frame alignment (the stream must carry the G.704 FAS in TS0)
+      */
+    Stream_Demux (const Batch_Demux & demux, Channel_Sink & sink, size_t capacity = STREAM_CAPACITY, bool monitor = false)
+        : demux (demux), sink (sink), capacity (capacity), monitor (monitor), out_pos (0), pending_length (0),
+          aligned (! monitor), fas_errors (0), hunt_length (0), dropped (0), losses (0)
+    {
+        assert (capacity % DST_SIZE == 0);
+        out = new byte * [NUM_TIMESLOTS];
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            out [i] = (byte *) _mm_malloc (capacity, 32);
+        }
+        pending = (byte *) _mm_malloc (SRC_SIZE, 32);
+        hunt_buffer = monitor ? new byte [HUNT_SIZE] : NULL;
+    }
+
+    ~Stream_Demux ()
+    {
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            _mm_free (out [i]);
+        }
+        delete[] out;
+        _mm_free (pending);
+        delete[] hunt_buffer;
+    }
+
+    void write (const byte * data, size_t length)
+    {
+        while (length != 0) {
+            size_t n = aligned ? write_aligned (data, length) : hunt (data, length);
+            data += n;
+            length -= n;
+        }
+    }
+
+    /** Demultiplexes the frames of the last incomplete block and passes everything to the sink
+      * @return the number of bytes at the end of the stream that do not make a complete frame (ignored),
+      *         or, if the frame boundary is being searched for, that have not been aligned
+      */
+    size_t finish ()
+    {
+        if (! aligned) {
+            flush ();
+            size_t rest = hunt_length;
+            hunt_length = 0;
+            return rest;
+        }
+        size_t frames = pending_length / NUM_TIMESLOTS;
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            for (size_t j = 0; j < frames; j++) {
+                out [i][out_pos + j] = pending [j * NUM_TIMESLOTS + i];
+            }
+        }
+        out_pos += frames;
+        flush ();
+        size_t rest = pending_length - frames * NUM_TIMESLOTS;
+        pending_length = 0;
+        return rest;
+    }
+
+    /** @return the number of times the frame alignment was lost */
+    size_t alignment_losses () const
+    {
+        return losses;
+    }
+};
+
+#ifdef __linux__
+/** Writes every timeslot into its own file, named prefix.NN */
+class File_Sink : public Channel_Sink
+{
+    int fds [NUM_TIMESLOTS];
+
+public:
+    File_Sink (const char * prefix)
+    {
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            char name [4096];
+            snprintf (name, sizeof (name), "%s.%02u", prefix, (unsigned) i);
+            fds [i] = open (name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fds [i] < 0) {
+                perror (name);
+                exit (1);
+            }
+        }
+    }
+
+    ~File_Sink ()
+    {
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            close (fds [i]);
+        }
+    }
+
+    void write (byte ** channels, size_t length)
+    {
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            for (size_t pos = 0; pos < length; ) {
+                ssize_t n = ::write (fds [i], channels [i] + pos, length - pos);
+                if (n < 0) {
+                    perror ("write");
+                    exit (1);
+                }
+                pos += n;
+            }
+        }
+    }
+};
+#endif
+
+byte * generate ()
+{
+    byte * buf = (byte*) _mm_malloc (SRC_SIZE, 32); // new byte [SRC_SIZE];
+    srand (0);
+    for (size_t i = 0; i < SRC_SIZE; i++) buf[i] = (byte) (rand () % 256);
+    return buf;
+}
+    
+byte ** allocate_dst ()
+{
+    byte ** result = new byte * [NUM_TIMESLOTS];
+    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+        result [i] = (byte *) _mm_malloc (DST_SIZE, 32); // new byte [DST_SIZE];
+        memset (result [i], 0, DST_SIZE);
+    }
+    return result;
+}
+
+void delete_dst (byte ** dst)
+{
+    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+        _mm_free (dst [i]); // delete dst [i];
+    }
+    delete[] dst;
+}
+
+/** Allocates a source buffer and NUM_TIMESLOTS channel buffers in an arena; exits if that fails
+  * @return the source buffer
+  */
+byte * allocate_in_arena (Arena & arena, size_t src_size, byte ** channels, size_t capacity, size_t skew)
+{
+    byte * src = arena.allocate (src_size, 4096);
+    if (src == NULL || ! arena.allocate_channels (channels, NUM_TIMESLOTS, capacity, skew)) {
+        cout << (arena.valid () ? "Arena too small" : "Cannot map an arena") << " for "
+             << src_size << " bytes of source and " << NUM_TIMESLOTS << " channels of " << capacity << " bytes\n";
+        exit (1);
+    }
+    return src;
+}
+    
+void check (const Demux & demux)
+{
+    byte * src = generate ();
+    byte ** dst0 = allocate_dst ();
+    byte ** dst = allocate_dst ();
+    Reference().demux (src, SRC_SIZE, dst0);
+    demux.demux (src, SRC_SIZE, dst);
+
+    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+        if (memcmp (dst0[i], dst[i], DST_SIZE)) {
+            cout << typeid (demux).name() << ": results not equal: line " << i << "\n";
+            exit (1);
+        }
+    }
+    _mm_free (src);
+    delete_dst (dst0);
+    delete_dst (dst);
+}
+
+#ifdef __SSE4_1__
+
+void reference_activity (byte ** dst, Activity & activity)
+{
+    activity.active = 0;
+    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+        bool repeats = true;
+        uint32_t energy = 0;
+        for (size_t j = 0; j < DST_SIZE; j++) {
+            byte b = dst [i][j];
+            if (j >= DST_SIZE / 2 && b != dst [i][j - DST_SIZE / 2]) repeats = false;
+            energy += (b ^ 0x55) & 0x7F;
+        }
+        if (! repeats) activity.active |= (uint32_t) 1 << i;
+        activity.energy [i] = energy;
+    }
+}
+
+void check_activity (const char * name, const Demux & demux, const Activity & activity, bool energy)
+{
+    byte * src = generate ();
+    for (size_t j = 0; j < DST_SIZE; j++) {
+        src [j * NUM_TIMESLOTS + 3] = 0xD5;
+        src [j * NUM_TIMESLOTS + 7] = (j & 1) ? 0xD5 : 0x54;
+        src [j * NUM_TIMESLOTS + 20] = 0x42;
+        src [j * NUM_TIMESLOTS + 26] = src [(j % 8) * NUM_TIMESLOTS + 26];
+    }
+    src [37 * NUM_TIMESLOTS + 20] = 0x43;
+    byte ** dst = allocate_dst ();
+    Activity expected;
+    demux.demux (src, SRC_SIZE, dst);
+    reference_activity (dst, expected);
+    if (expected.active != ~ ((1u << 3) | (1u << 7) | (1u << 26))) {
+        cout << "reference_activity: wrong idle timeslots\n";
+        exit (1);
+    }
+    if (activity.active != expected.active
+        || (energy && memcmp (activity.energy, expected.energy, sizeof (activity.energy)))) {
+        cout << name << ": activity not equal\n";
+        exit (1);
+    }
+    _mm_free (src);
+    delete_dst (dst);
+}
+
+void check_activity ()
+{
+    Activity activity;
+    check (Read16_Write16_SSE_Activity (activity));
+    check_activity ("Read16_Write16_SSE_Activity", Read16_Write16_SSE_Activity (activity), activity, false);
+    check_activity ("Unrolled_Activity<Block_16x16_SSE, true>", Unrolled_Activity<Block_16x16_SSE, true> (activity),
+                    activity, true);
+#ifdef __AVX2__
+    check (Read32_Write32_AVX2_Activity (activity));
+    check_activity ("Read32_Write32_AVX2_Activity", Read32_Write32_AVX2_Activity (activity), activity, false);
+    check (Read32_Write32_AVX2_Energy (activity));
+    check_activity ("Read32_Write32_AVX2_Energy", Read32_Write32_AVX2_Energy (activity), activity, true);
+#endif
+}
+
+#endif
+
+#ifdef __AVX2__
+
+void check_in_place ()
+{
+    byte * src = generate ();
+    byte * block = (byte *) _mm_malloc (SRC_SIZE, 32);
+    memcpy (block, src, SRC_SIZE);
+    In_Place_Demux ().demux (block);
+    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+        for (size_t j = 0; j < DST_SIZE; j++) {
+            if (block [i * DST_SIZE + j] != src [j * NUM_TIMESLOTS + i]) {
+                cout << "In-place results not equal: line " << i << "\n";
+                exit (1);
+            }
+        }
+    }
+    _mm_free (src);
+    _mm_free (block);
+}
+
+#endif
+
+byte * src;
+byte ** dst;
+
+#ifdef __linux__
+/** Hardware counters around the measurements, set by the "counters" command */
+Perf_Counters * counters = NULL;
+#endif
+
+void start_counters ()
+{
+#ifdef __linux__
+    if (counters) counters->start ();
+#endif
+}
+
+/** Stops the counters and prints their values per block
+  * @param blocks  number of blocks processed since start_counters ()
+  */
+void report_counters (size_t blocks)
+{
+#ifdef __linux__
+    if (! counters) return;
+    counters->stop ();
+    cout << "    per block:";
+    if (counters->available (Perf_Counters::CYCLES)) {
+        cout << " cycles " << counters->value (Perf_Counters::CYCLES) / blocks;
+    }
+    if (counters->available (Perf_Counters::INSTRUCTIONS)) {
+        cout << ", instructions " << counters->value (Perf_Counters::INSTRUCTIONS) / blocks;
+        if (counters->value (Perf_Counters::CYCLES) != 0) {
+            cout << ", IPC " << counters->value (Perf_Counters::INSTRUCTIONS) / counters->value (Perf_Counters::CYCLES);
+        }
+    }
+    if (counters->available (Perf_Counters::L1D_MISSES)) {
+        cout << ", L1D misses " << counters->value (Perf_Counters::L1D_MISSES) / blocks;
+    }
+    if (counters->available (Perf_Counters::LLC_MISSES)) {
+        cout << ", LLC misses " << counters->value (Perf_Counters::LLC_MISSES) / blocks;
+    }
+    if (counters->available (Perf_Counters::STORE_FORWARD_BLOCKS)) {
+        cout << ", store forward blocks " << counters->value (Perf_Counters::STORE_FORWARD_BLOCKS) / blocks;
+    }
+    if (counters->available (Perf_Counters::SHUFFLE_PORT_UOPS)) {
+        cout << ", port 5 uops " << counters->value (Perf_Counters::SHUFFLE_PORT_UOPS) / blocks;
+    }
+    cout << endl;
+#endif
+}
+
+/** measure() without the virtual call: the kernel is called with its static type, so it can be inlined into the loop */
+template<class K> void measure_static (const K & demux)
+{
+    start_counters ();
+    uint64_t t0 = currentTimeMillis ();
+    for (unsigned i = 0; i < ITERATIONS; i++) {
+        demux.K::demux (src, SRC_SIZE, dst);
+    }
+    uint64_t t = currentTimeMillis () - t0;
+    cout << typeid (demux).name() << ", static: " << t << endl;
+    report_counters (ITERATIONS);
+}
+
+void measure (const Demux & demux)
+{
+//    check (demux);
+
+    start_counters ();
+    uint64_t t0 = currentTimeMillis ();
+    for (unsigned i = 0; i < ITERATIONS; i++) {
+        demux.demux (src, SRC_SIZE, dst);
+    }
+    uint64_t t = currentTimeMillis () - t0;
+    cout << typeid (demux).name() << ": " << t << endl;
+    report_counters (ITERATIONS);
+}
+
+#ifdef __AVX2__
+
+void measure_in_place ()
+{
+    In_Place_Demux demux;
+    // the kernel permutes its block, so it works on a copy: src is the input of all the other measurements
+    byte * block = (byte *) _mm_malloc (SRC_SIZE, 32);
+    memcpy (block, src, SRC_SIZE);
+    start_counters ();
+    uint64_t t0 = currentTimeMillis ();
+    for (unsigned i = 0; i < ITERATIONS; i++) {
+        demux.demux (block);
+    }
+    uint64_t t = currentTimeMillis () - t0;
+    cout << "In_Place_Demux: " << t << endl;
+    report_counters (ITERATIONS);
+    _mm_free (block);
+}
+
+inline byte reverse_byte (byte b)
+{
+    byte r = 0;
+    for (int i = 0; i < 8; i++) {
+        if (b >> i & 1) r |= (byte) (0x80 >> i);
+    }
+    return r;
+}
+
+int16_t ** allocate_linear ()
+{
+    int16_t ** result = new int16_t * [NUM_TIMESLOTS];
+    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+        result [i] = (int16_t *) _mm_malloc (DST_SIZE * sizeof (int16_t), 32);
+    }
+    return result;
+}
+
+void delete_linear (int16_t ** dst)
+{
+    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+        _mm_free (dst [i]);
+    }
+    delete[] dst;
+}
+
+void check_reversed ()
+{
+    byte ** dst0 = allocate_dst ();
+    byte ** dst1 = allocate_dst ();
+    int16_t ** lin = allocate_linear ();
+    Reference ().demux (src, SRC_SIZE, dst0);
+
+    Read16_Write16_SSE_Reverse_Unroll ().demux (src, SRC_SIZE, dst1);
+    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+        for (size_t j = 0; j < DST_SIZE; j++) {
+            if (dst1 [i][j] != reverse_byte (dst0 [i][j])) {
+                cout << "Read16_Write16_SSE_Reverse_Unroll: results not equal: line " << i << "\n";
+                exit (1);
+            }
+        }
+    }
+    Read32_Write32_AVX2_Reverse_Unroll ().demux (src, SRC_SIZE, dst1);
+    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+        for (size_t j = 0; j < DST_SIZE; j++) {
+            if (dst1 [i][j] != reverse_byte (dst0 [i][j])) {
+                cout << "Read32_Write32_AVX2_Reverse_Unroll: results not equal: line " << i << "\n";
+                exit (1);
+            }
+        }
+    }
+    Read32_Write32_AVX2_Linear<false> ().demux (src, SRC_SIZE, lin);
+    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+        for (size_t j = 0; j < DST_SIZE; j++) {
+            if (lin [i][j] != alaw_to_linear (dst0 [i][j])) {
+                cout << "Read32_Write32_AVX2_Linear: results not equal: line " << i << "\n";
+                exit (1);
+            }
+        }
+    }
+    Read32_Write32_AVX2_Linear<true> ().demux (src, SRC_SIZE, lin);
+    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+        for (size_t j = 0; j < DST_SIZE; j++) {
+            if (lin [i][j] != alaw_to_linear (reverse_byte (dst0 [i][j]))) {
+                cout << "Read32_Write32_AVX2_Linear (reversed): results not equal: line " << i << "\n";
+                exit (1);
+            }
+        }
+    }
+    delete_dst (dst0);
+    delete_dst (dst1);
+    delete_linear (lin);
+}
+
+/** Compares the fused bit reversal and A-law expansion with a second pass over the channel buffers
+  * (table lookups after Read32_Write32_AVX2_Unpack_Unroll)
+  */
+void measure_reversed ()
+{
+    byte reversed [256];
+    int16_t linear [256];
+    for (size_t i = 0; i < 256; i++) {
+        reversed [i] = reverse_byte ((byte) i);
+        linear [i] = (int16_t) alaw_to_linear (reverse_byte ((byte) i));
+    }
+    Read32_Write32_AVX2_Unpack_Unroll demux;
+    int16_t ** lin = allocate_linear ();
+
+    uint64_t t0 = currentTimeMillis ();
+    for (unsigned n = 0; n < ITERATIONS; n++) {
+        demux.demux (src, SRC_SIZE, dst);
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            byte * d = dst [i];
+            for (size_t j = 0; j < DST_SIZE; j++) d [j] = reversed [d [j]];
+        }
+    }
+    cout << "Read32_Write32_AVX2_Unpack_Unroll, then reversal: " << currentTimeMillis () - t0 << endl;
+
+    Read32_Write32_AVX2_Reverse_Unroll reverse;
+    t0 = currentTimeMillis ();
+    for (unsigned n = 0; n < ITERATIONS; n++) {
+        reverse.demux (src, SRC_SIZE, dst);
+    }
+    cout << "Read32_Write32_AVX2_Reverse_Unroll: " << currentTimeMillis () - t0 << endl;
+
+    t0 = currentTimeMillis ();
+    for (unsigned n = 0; n < ITERATIONS; n++) {
+        demux.demux (src, SRC_SIZE, dst);
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            const byte * d = dst [i];
+            int16_t * l = lin [i];
+            for (size_t j = 0; j < DST_SIZE; j++) l [j] = linear [d [j]];
+        }
+    }
+    cout << "Read32_Write32_AVX2_Unpack_Unroll, then reversal and expansion: " << currentTimeMillis () - t0 << endl;
+
+    Read32_Write32_AVX2_Linear<true> expand;
+    t0 = currentTimeMillis ();
+    for (unsigned n = 0; n < ITERATIONS; n++) {
+        expand.demux (src, SRC_SIZE, lin);
+    }
+    cout << "Read32_Write32_AVX2_Linear (reversed): " << currentTimeMillis () - t0 << endl;
+    delete_linear (lin);
+}
+
+/** @return a mask of n timeslots spread over the frame */
+uint32_t spread_timeslots (size_t n)
+{
+    uint32_t mask = 0;
+    for (size_t i = 0; i < n; i++) {
+        mask |= 1u << (i * NUM_TIMESLOTS / n);
+    }
+    return mask;
+}
+
+void check_select ()
+{
+    byte ** dst0 = allocate_dst ();
+    byte ** dst1 = allocate_dst ();
+    Reference ().demux (src, SRC_SIZE, dst0);
+    for (size_t n = 1; n <= NUM_TIMESLOTS; n++) {
+        uint32_t mask = spread_timeslots (n);
+        for (size_t crossover = 0; crossover <= NUM_TIMESLOTS; crossover += NUM_TIMESLOTS) {
+            for (size_t i = 0; i < NUM_TIMESLOTS; i++) memset (dst1 [i], 0, DST_SIZE);
+            Select_Demux (mask, crossover).demux (src, SRC_SIZE, dst1);
+            for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+                if ((mask >> i & 1) && memcmp (dst0 [i], dst1 [i], DST_SIZE)) {
+                    cout << "Selected results not equal: " << n << " timeslots, line " << i << "\n";
+                    exit (1);
+                }
+            }
+        }
+    }
+    delete_dst (dst0);
+    delete_dst (dst1);
+}
+
+/** Compares gathers of selected timeslots with the full transpositions for different numbers of timeslots */
+void measure_select ()
+{
+    uint64_t t0 = currentTimeMillis ();
+    Read32_Write32_AVX2_Unpack_Unroll full;     // the one Select_Demux uses
+    for (unsigned i = 0; i < ITERATIONS; i++) {
+        full.demux (src, SRC_SIZE, dst);
+    }
+    cout << "Read32_Write32_AVX2_Unpack_Unroll, all timeslots: " << currentTimeMillis () - t0 << endl;
+
+    const size_t counts [] = {1, 2, 4, 8, 12, 16, 24, 32};
+    for (size_t n : counts) {
+        uint64_t t0 = currentTimeMillis ();
+        Gather_Select gather (spread_timeslots (n));
+        for (unsigned i = 0; i < ITERATIONS; i++) {
+            gather.demux (src, SRC_SIZE, dst);
+        }
+        cout << "Gather_Select, " << n << " timeslots: " << currentTimeMillis () - t0 << endl;
+    }
+    size_t crossover = gather_crossover ();
+    cout << "Gathers are used for up to " << crossover << " timeslots" << endl;
+}
+
+#endif
+
+// ------- Frame alignment
+
+static const size_t ALIGNMENT_FRAMES = 128 * DST_SIZE;
+static const size_t ALIGNMENT_SLIP_FRAME = 3001;     // this frame is missing from the stream
+static const size_t ALIGNMENT_CUT_FRAME = 6000;      // and ALIGNMENT_CUT_BYTES bytes of this one
+static const size_t ALIGNMENT_CUT_BYTES = 7;
+
+/** Byte of timeslot i of frame n of a test stream: the FAS and NFAS in TS0, the frame number in TS1 and TS2,
+  * and bytes that cannot be taken for the FAS elsewhere. The FAS of frame 1000, and of frames 2000 and 2002
+  * (two errors in a row, one less than needed to lose the alignment), are corrupted.
+  */
+byte framed_byte (size_t n, size_t i)
+{
+    if (i == 0) {
+        if (n % 2) return (byte) (0xC0 | (n & 0x1F));
+        return n == 1000 || n == 2000 || n == 2002 ? 0x9A : 0x9B;
+    }
+    if (i == 1) return (byte) (n & 0x7F);
+    if (i == 2) return (byte) (n >> 7 & 0x7F);
+    byte b = (byte) (((uint32_t) (n * 31 + i * 17) * 2654435761u) >> 24);
+    return (b & FAS_MASK) == FAS ? b ^ 1 : b;
+}
+
+/** Generates a test stream: some bytes before the first frame, then ALIGNMENT_FRAMES frames with a slip and a cut
+  * @return the stream, allocated with _mm_malloc; length receives its size
+  */
+byte * generate_framed (size_t & length)
+{
+    byte * buf = (byte *) _mm_malloc (ALIGNMENT_FRAMES * NUM_TIMESLOTS + 64, 32);
+    size_t pos = 0;
+    for (size_t k = 0; k < 13; k++) buf [pos ++] = 0;
+    for (size_t n = 0; n < ALIGNMENT_FRAMES; n++) {
+        if (n == ALIGNMENT_SLIP_FRAME) continue;
+        for (size_t i = n == ALIGNMENT_CUT_FRAME ? ALIGNMENT_CUT_BYTES : 0; i < NUM_TIMESLOTS; i++) {
+            buf [pos ++] = framed_byte (n, i);
+        }
+    }
+    length = pos;
+    return buf;
+}
+
+/** Collects the output of Stream_Demux in memory */
+class Memory_Sink : public Channel_Sink
+{
+public:
+    vector<byte> channels [NUM_TIMESLOTS];
+    vector<size_t> realignments;
+
+    void write (byte ** out, size_t length)
+    {
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            channels [i].insert (channels [i].end (), out [i], out [i] + length);
+        }
+    }
+
+    void realigned (size_t dropped)
+    {
+        realignments.push_back (dropped);
+    }
+};
+
+/** Demultiplexes the test stream in pieces of random sizes (so some start at unaligned addresses) with the
+  * FAS monitored, and checks that the output is whole frames of the original stream in order, that everything
+  * after the slip and the cut is recovered within a block, and that the bit errors do not cause realignment.
+  */
+void check_alignment ()
+{
+    size_t length;
+    byte * stream = generate_framed (length);
+    Static_Batch<Stream_Kernel> demux;
+    Memory_Sink sink;
+    Stream_Demux s (demux, sink, 4 * DST_SIZE, true);
+    srand (0);
+    for (size_t pos = 0; pos < length;) {
+        size_t n = min ((size_t) (rand () % 3000 + 1), length - pos);
+        s.write (stream + pos, n);
+        pos += n;
+    }
+    s.finish ();
+
+    if (s.alignment_losses () != 2 || sink.realignments.size () != 3 || sink.realignments [0] != 13) {
+        cout << "Stream_Demux: " << s.alignment_losses () << " alignment losses, "
+             << sink.realignments.size () << " realignments, expected 2 and 3\n";
+        exit (1);
+    }
+    size_t frames = sink.channels [0].size ();
+    size_t prev = 0;
+    for (size_t j = 0; j < frames; j++) {
+        size_t n = sink.channels [1][j] | (size_t) sink.channels [2][j] << 7;
+        if (j != 0 && n <= prev) {
+            cout << "Stream_Demux: frame " << n << " follows frame " << prev << "\n";
+            exit (1);
+        }
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            if (sink.channels [i][j] != framed_byte (n, i) || n == ALIGNMENT_SLIP_FRAME || n == ALIGNMENT_CUT_FRAME) {
+                cout << "Stream_Demux: output frame " << j << " is not frame " << n << " of the stream\n";
+                exit (1);
+            }
+        }
+        prev = n;
+    }
+    size_t lost = ALIGNMENT_FRAMES - frames;
+    if (prev != ALIGNMENT_FRAMES - 1 || lost > 2 * (DST_SIZE + 2 * FAS_ERRORS_LOST + 2)) {
+        cout << "Stream_Demux: " << lost << " frames lost, the last one is " << prev << "\n";
+        exit (1);
+    }
+    _mm_free (stream);
+}
+
+/** Discards the output */
+class Null_Sink : public Channel_Sink
+{
+public:
+    void write (byte **, size_t)
+    {
+    }
+};
+
+/** Compares Stream_Demux with and without the monitoring of frame alignment, on an aligned stream */
+void measure_alignment ()
+{
+    const size_t blocks = 4096;
+    const unsigned repeats = (unsigned) (ITERATIONS / blocks);
+    byte * stream = (byte *) _mm_malloc (blocks * SRC_SIZE, 32);
+    for (size_t n = 0; n < blocks * DST_SIZE; n++) {
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            stream [n * NUM_TIMESLOTS + i] = framed_byte (n % 1000 + 2, i);
+        }
+    }
+    Static_Batch<Stream_Kernel> demux;
+    Null_Sink sink;
+    for (int monitor = 0; monitor < 2; monitor++) {
+        uint64_t t0 = currentTimeMillis ();
+        for (unsigned r = 0; r < repeats; r++) {
+            Stream_Demux s (demux, sink, STREAM_CAPACITY, monitor != 0);
+            s.write (stream, blocks * SRC_SIZE);
+            s.finish ();
+        }
+        cout << "Stream_Demux" << (monitor ? ", with frame alignment monitoring: " : ": ")
+             << currentTimeMillis () - t0 << endl;
+    }
+    _mm_free (stream);
+}
+
+#ifdef __AVX2__
+
+// ------- Memory hierarchy
+
+/** Default working sets for measure_hierarchy, in kilobytes: meant to fit in L1, L2, L3 and to exceed any cache */
+static const size_t HIERARCHY_LEVELS [] = {16, 128, 8 * 1024, 1024 * 1024};
+
+/** A pool of source blocks and their destinations, used in rotation, so that the data comes from the
+  * required level of the memory hierarchy instead of staying in L1 as in measure().
+  * Every block takes SRC_SIZE bytes of source, the same amount of destination and the channel pointers.
+  */
+class Block_Pool
+{
+public:
+    const size_t blocks;
+    byte * src;
+    byte * dst_data;
+    byte ** dst;
+
+    Block_Pool (size_t working_set) : blocks (max (working_set / (2 * SRC_SIZE + NUM_TIMESLOTS * sizeof (byte *)), (size_t) 1))
+    {
+        src = (byte *) _mm_malloc (blocks * SRC_SIZE, 64);
+        dst_data = (byte *) _mm_malloc (blocks * SRC_SIZE, 64);
+        dst = new byte * [blocks * NUM_TIMESLOTS];
+        srand (0);
+        for (size_t i = 0; i < blocks * SRC_SIZE; i++) src [i] = (byte) (rand () % 256);
+        memset (dst_data, 0, blocks * SRC_SIZE);
+        for (size_t i = 0; i < blocks * NUM_TIMESLOTS; i++) dst [i] = dst_data + i * DST_SIZE;
+    }
+
+    ~Block_Pool ()
+    {
+        _mm_free (src);
+        _mm_free (dst_data);
+        delete[] dst;
+    }
+
+    /** @return time, in milliseconds, of demultiplexing ITERATIONS blocks taken from the pool in rotation */
+    uint64_t run (const Demux & demux) const
+    {
+        for (size_t b = 0; b < blocks; b++) {      // warm up
+            demux.demux (src + b * SRC_SIZE, SRC_SIZE, dst + b * NUM_TIMESLOTS);
+        }
+        uint64_t t0 = currentTimeMillis ();
+        size_t b = 0;
+        for (unsigned i = 0; i < ITERATIONS; i++) {
+            demux.demux (src + b * SRC_SIZE, SRC_SIZE, dst + b * NUM_TIMESLOTS);
+            if (++ b == blocks) b = 0;
+        }
+        return currentTimeMillis () - t0;
+    }
+
+    /** @return time, in milliseconds, of demultiplexing ITERATIONS blocks of the pool in place */
+    uint64_t run_in_place (const In_Place_Demux & demux) const
+    {
+        demux.demux_blocks (src, blocks);
+        uint64_t t0 = currentTimeMillis ();
+        size_t b = 0;
+        for (unsigned i = 0; i < ITERATIONS; i++) {
+            demux.demux (src + b * SRC_SIZE);
+            if (++ b == blocks) b = 0;
+        }
+        return currentTimeMillis () - t0;
+    }
+};
+
+/** Measures the kernels with the working sets of given sizes, reporting throughput (source bytes per second)
+  * and its ratio to the throughput of Copy (memcpy of every channel), which is the bandwidth limit.
+  * The kernels are those of the main benchmark, including the slow scalar ones (Reference takes most of the time).
+  * In_Place_Demux only touches the source half of the working set.
+  * @param sizes  working set sizes in kilobytes
+  */
+void measure_hierarchy (const vector<size_t> & sizes)
+{
+    Copy copy;
+    Copy_AVX copy_avx;
+    Reference reference;
+    Write4 write4;
+    Write8 write8;
+    Read4_Write4 r4w4;
+    Read4_Write4_Unroll r4w4_unroll;
+    Read8_Write8 r8w8;
+    Read8_Write8_Unroll r8w8_unroll;
+    Read4_Write4_SSE r4w4_sse;
+    Read4_Write16_SSE r4w16_sse;
+    Read8_Write16_SSE r8w16_sse;
+    Read8_Write16_SSE_Unroll r8w16_sse_unroll;
+    Read16_Write16_SSE r16w16_sse;
+    Read16_Write16_SSE_Unroll r16w16_sse_unroll;
+    Read4_Write32_AVX r4w32_avx;
+    Read8_Write32_AVX r8w32_avx;
+    Read8_Write32_AVX_Unroll r8w32_avx_unroll;
+    Read16_Write8_SSE2_Unroll r16w8_sse2_unroll;
+    Read32_Write32_AVX2_Unroll r32w32_avx2_unroll;
+    Read16_Write16_SSE2_Unroll r16w16_sse2_unroll;
+    Read32_Write32_AVX2_Unpack_Unroll r32w32_avx2_unpack_unroll;
+    Read16_Write16_Vec_Unroll r16w16_vec_unroll;
+    Read32_Write32_Vec_Unroll r32w32_vec_unroll;
+#ifdef __AVX512BW__
+    Read32_Write32_Vec512_Unroll r32w32_vec512_unroll;
+#endif
+    const Demux * kernels [] = {
+        &copy, &copy_avx, &reference, &write4, &write8, &r4w4, &r4w4_unroll, &r8w8, &r8w8_unroll, &r4w4_sse, &r4w16_sse,
+        &r8w16_sse, &r8w16_sse_unroll, &r16w16_sse, &r16w16_sse_unroll, &r4w32_avx, &r8w32_avx, &r8w32_avx_unroll,
+        &r16w8_sse2_unroll, &r32w32_avx2_unroll, &r16w16_sse2_unroll, &r32w32_avx2_unpack_unroll,
+        &r16w16_vec_unroll, &r32w32_vec_unroll,
+#ifdef __AVX512BW__
+        &r32w32_vec512_unroll,
+#endif
+    };
+    const size_t num_kernels = sizeof (kernels) / sizeof (kernels [0]);
+    const In_Place_Demux in_place;
+
+    for (size_t size : sizes) {
+        Block_Pool pool (size * 1024);
+        cout << "Working set " << size << " KB, " << pool.blocks << " blocks" << endl;
+        double copy_rate = 0;
+        for (size_t k = 0; k < num_kernels; k++) {
+            uint64_t t = pool.run (* kernels [k]);
+            double rate = (double) ITERATIONS * SRC_SIZE / 1e6 / (t ? t : 1) * 1000;  // MB/s
+            if (k == 0) copy_rate = rate;
+            cout << "    " << typeid (* kernels [k]).name() << ": " << t << " ms, " << (uint64_t) rate << " MB/s, "
+                 << (int) (rate / copy_rate * 100 + 0.5) << "% of Copy" << endl;
+        }
+        uint64_t t = pool.run_in_place (in_place);
+        double rate = (double) ITERATIONS * SRC_SIZE / 1e6 / (t ? t : 1) * 1000;
+        cout << "    In_Place_Demux: " << t << " ms, " << (uint64_t) rate << " MB/s, "
+             << (int) (rate / copy_rate * 100 + 0.5) << "% of Copy" << endl;
+    }
+}
+
+// ------- Buffer layout
+
+/** Channel buffer sizes for measure_arena: the output of consecutive blocks is written one after another
+  * into the buffers, as in Stream_Demux, so a buffer of this size works as a block with a large DST_SIZE.
+  */
+static const size_t ARENA_CAPACITIES [] = {4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024};
+
+/** Demultiplexes a number of blocks into channel buffers of the given capacity, filling them consecutively
+  * @return time in milliseconds
+  */
+uint64_t run_channels (const Demux & demux, const byte * src, byte * const * channels, size_t capacity,
+                       unsigned iterations = ITERATIONS)
+{
+    const size_t blocks = capacity / DST_SIZE;
+    byte * d [NUM_TIMESLOTS];
+    uint64_t t0 = currentTimeMillis ();
+    size_t b = 0;
+    for (unsigned i = 0; i < iterations; i++) {
+        for (size_t j = 0; j < NUM_TIMESLOTS; j++) {
+            d [j] = channels [j] + b * DST_SIZE;
+        }
+        demux.demux (src + b * SRC_SIZE, SRC_SIZE, d);
+        if (++ b == blocks) b = 0;
+    }
+    return currentTimeMillis () - t0;
+}
+
+/** Compares the layouts of channel buffers: separate _mm_malloc calls (as in allocate_dst), an arena
+  * with channels placed back to back, and an arena with the channels skewed by the given number of bytes.
+  */
+void measure_arena (size_t skew)
+{
+    const Read16_Write16_SSE_Unroll demux;
+
+    for (size_t capacity : ARENA_CAPACITIES) {
+        const size_t src_size = capacity / DST_SIZE * SRC_SIZE;
+        byte * channels [NUM_TIMESLOTS];
+
+        byte * src = (byte *) _mm_malloc (src_size, 64);
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            channels [i] = (byte *) _mm_malloc (capacity, 32);
+            memset (channels [i], 0, capacity);
+        }
+        memset (src, 0x55, src_size);
+        uint64_t t_malloc = run_channels (demux, src, channels, capacity);
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            _mm_free (channels [i]);
+        }
+        _mm_free (src);
+
+        uint64_t t_arena [2];
+        bool huge = false;
+        for (size_t k = 0; k < 2; k++) {
+            size_t channel_skew = k == 0 ? 0 : skew;
+            Arena arena (src_size + NUM_TIMESLOTS * (capacity + channel_skew) + 4096);
+            huge = arena.hugepages ();
+            byte * src = allocate_in_arena (arena, src_size, channels, capacity, channel_skew);
+            memset (src, 0x55, src_size);
+            for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+                memset (channels [i], 0, capacity);
+            }
+            t_arena [k] = run_channels (demux, src, channels, capacity);
+        }
+        cout << typeid (demux).name() << ", channel size " << capacity
+             << ": malloc: " << t_malloc
+             << "; arena" << (huge ? " (hugepages)" : "") << ": " << t_arena [0]
+             << "; arena, skew " << skew << ": " << t_arena [1] << endl;
+    }
+}
+
+#endif
+
+// ------- Parallel scaling
+
+static const size_t PARALLEL_BLOCKS = 128 * 1024;  // 256 MB of source and 256 MB of output
+
+/** Checks the output of parallel_demux for PARALLEL_BLOCKS blocks against Reference, block by block */
+void check_parallel (const byte * src, byte * const * dst, unsigned threads)
+{
+    byte ** dst0 = allocate_dst ();
+    for (size_t b = 0; b < PARALLEL_BLOCKS; b++) {
+        Reference ().demux (src + b * SRC_SIZE, SRC_SIZE, dst0);
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            if (memcmp (dst0 [i], dst [i] + b * DST_SIZE, DST_SIZE)) {
+                cout << "parallel_demux, " << threads << " threads: results not equal: block " << b << ", line " << i << "\n";
+                exit (1);
+            }
+        }
+    }
+    delete_dst (dst0);
+}
+
+/** Demultiplexes one buffer of PARALLEL_BLOCKS blocks with parallel_demux on 1, 2, 4 ... threads,
+  * and checks the output of every run
+  * @param max_threads  the largest number of threads
+  */
+void measure_parallel (unsigned max_threads)
+{
+    const Static_Batch<Stream_Kernel> demux;
+    const size_t channel_size = PARALLEL_BLOCKS * DST_SIZE;
+    Arena arena (PARALLEL_BLOCKS * SRC_SIZE + NUM_TIMESLOTS * (channel_size + 64) + 4096);
+    byte * dst [NUM_TIMESLOTS];
+    byte * src = allocate_in_arena (arena, PARALLEL_BLOCKS * SRC_SIZE, dst, channel_size, 64);
+    srand (0);
+    for (size_t i = 0; i < PARALLEL_BLOCKS * SRC_SIZE; i++) src [i] = (byte) (rand () % 256);
+
+    uint64_t t1 = 0;
+    for (unsigned threads = 1; ; threads *= 2) {
+        if (threads > max_threads) threads = max_threads;
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            memset (dst [i], 0, channel_size);
+        }
+        uint64_t t = currentTimeMillis ();
+        parallel_demux (demux, src, PARALLEL_BLOCKS, dst, threads);
+        t = currentTimeMillis () - t;
+        if (t == 0) t = 1;
+        if (threads == 1) t1 = t;
+        cout << "parallel_demux, " << threads << " threads: " << t << " ms, "
+             << (uint64_t) ((double) PARALLEL_BLOCKS * SRC_SIZE / 1000 / t) << " MB/s, speedup " << (double) t1 / t << endl;
+        check_parallel (src, dst, threads);
+        if (threads == max_threads) break;
+    }
+}
+
+#ifdef __AVX2__
+
+// ------- Latency
+
+/** @return the number of time stamp counter ticks per nanosecond, measured once against the system clock */
+double ticks_per_ns ()
+{
+    static double ratio = 0;
+    if (ratio != 0) return ratio;
+    uint64_t t0 = currentTimeMillis ();
+    while (currentTimeMillis () == t0);
+    t0 = currentTimeMillis ();
+    uint64_t c0 = timestamp ();
+    uint64_t t1;
+    while ((t1 = currentTimeMillis ()) - t0 < 200);
+    ratio = (double) (timestamp () - c0) / ((double) (t1 - t0) * 1E6);
+    return ratio;
+}
+
+/** Times the kernel on groups of calls; every group adds its time per call, in ticks, to the histogram */
+void run_latency (const Demux & demux, unsigned group, Latency_Histogram & histogram)
+{
+    for (unsigned i = 0; i < ITERATIONS; i += group) {
+        uint64_t t0 = timestamp ();
+        for (unsigned j = 0; j < group; j++) {
+            demux.demux (src, SRC_SIZE, dst);
+        }
+        histogram.record ((timestamp () - t0) / group);
+    }
+}
+
+/** Prints the percentiles of the time of a call (or of a group of calls, per call) for a set of kernels.
+  * Unlike the average from measure, they show the outliers: page faults, interrupts, frequency changes.
+  * Null shows the cost of the time stamps themselves.
+  * @param group     number of calls timed together
+  * @param cpu       CPU to run on, or -1 to leave the thread unpinned
+  * @param load_cpu  CPU to run a busy-spinning thread on (such as the hyperthread sibling of cpu), or -1 for none
+  */
+void measure_latency (unsigned group, int cpu, int load_cpu)
+{
+#ifdef __linux__
+    if (cpu >= 0 && ! pin_thread (vector<int> (1, cpu))) {
+        cout << "Can't run on CPU " << cpu << endl;
+    }
+#endif
+    atomic<bool> stop (false);
+    volatile uint64_t sink;
+    thread load;
+    if (load_cpu >= 0) {
+        load = thread ([&] () {
+#ifdef __linux__
+            if (! pin_thread (vector<int> (1, load_cpu))) cout << "Can't run the load on CPU " << load_cpu << endl;
+#endif
+            uint64_t x = 1;
+            while (! stop.load (memory_order_relaxed)) {
+                for (int i = 0; i < 1024; i++) x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            }
+            sink = x;
+        });
+    }
+
+    Null null;
+    Copy_AVX copy_avx;
+    Write8 write8;
+    Read8_Write8_Unroll r8w8_unroll;
+    Read4_Write16_SSE r4w16_sse;
+    Read16_Write16_SSE_Unroll r16w16_sse_unroll;
+    Read8_Write32_AVX_Unroll r8w32_avx_unroll;
+    Read32_Write32_AVX2_Unroll r32w32_avx2_unroll;
+    Read32_Write32_AVX2_Unpack_Unroll r32w32_avx2_unpack_unroll;
+    const Demux * kernels [] = {
+        &null, &copy_avx, &write8, &r8w8_unroll, &r4w16_sse, &r16w16_sse_unroll, &r8w32_avx_unroll,
+        &r32w32_avx2_unroll, &r32w32_avx2_unpack_unroll
+    };
+
+    const double ratio = ticks_per_ns ();
+    cout << "Time per call, ns (" << group << (group == 1 ? " call" : " calls") << " per sample, "
+         << ratio << " ticks per ns)" << endl;
+    for (const Demux * demux : kernels) {
+        Latency_Histogram histogram;
+        run_latency (*demux, group, histogram);
+        cout << typeid (*demux).name () << ": p50 " << (uint64_t) (histogram.percentile (0.5) / ratio)
+             << ", p99 " << (uint64_t) (histogram.percentile (0.99) / ratio)
+             << ", p99.9 " << (uint64_t) (histogram.percentile (0.999) / ratio)
+             << ", max " << (uint64_t) (histogram.max () / ratio) << endl;
+    }
+
+    if (load_cpu >= 0) {
+        stop = true;
+        load.join ();
+    }
+}
+
+// ------- Baseline and regressions
+
+static const unsigned BASELINE_REPEATS = 15;
+static const unsigned BASELINE_CALLS = ITERATIONS / 10;
+static const double REGRESSION_Z = 2.33;    // one-sided 1% of the normal distribution
+
+/** Times of one kernel: time per call in every repetition, ns */
+struct Kernel_Times
+{
+    string name;
+    vector<double> times;
+};
+
+/** Results of the benchmark suite and where they were obtained */
+struct Suite_Results
+{
+    string cpu;
+    string compiler;
+    string geometry;
+    vector<Kernel_Times> kernels;
+};
+
+string cpu_model ()
+{
+    unsigned regs [12];
+    if (! __get_cpuid (0x80000004, &regs [0], &regs [1], &regs [2], &regs [3])) return "unknown";
+    for (unsigned i = 0; i < 3; i++) {
+        __get_cpuid (0x80000002 + i, &regs [4 * i], &regs [4 * i + 1], &regs [4 * i + 2], &regs [4 * i + 3]);
+    }
+    string model ((const char *) regs, strnlen ((const char *) regs, sizeof (regs)));
+    size_t first = model.find_first_not_of (' ');
+    return first == string::npos ? "unknown" : model.substr (first, model.find_last_not_of (' ') - first + 1);
+}
+
+string compiler_version ()
+{
+#if defined (__clang__)
+    return "clang " __clang_version__;
+#elif defined (__GNUC__)
+    return "gcc " __VERSION__;
+#else
+    return "unknown";
+#endif
+}
+
+string geometry ()
+{
+    ostringstream s;
+    s << NUM_TIMESLOTS << " timeslots, " << DST_SIZE << " frames";
+#ifdef __AVX512BW__
+    s << ", AVX-512";
+#endif
+    return s.str ();
+}
+
+/** In_Place_Demux as a Demux, for the suite. It demultiplexes its own copy of the source block again and again
+  * (src is the input of all the other kernels), as in measure_in_place, and does not touch dst.
+  */
+class In_Place_Demux_Suite : public Demux
+{
+    const In_Place_Demux in_place;
+    byte * const block;
+
+public:
+    In_Place_Demux_Suite () : block ((byte *) _mm_malloc (SRC_SIZE, 32))
+    {
+        memcpy (block, src, SRC_SIZE);
+    }
+
+    ~In_Place_Demux_Suite ()
+    {
+        _mm_free (block);
+    }
+
+    In_Place_Demux_Suite (const In_Place_Demux_Suite &) = delete;
+    In_Place_Demux_Suite & operator = (const In_Place_Demux_Suite &) = delete;
+
+    void demux (const byte *, size_t, byte **) const
+    {
+        in_place.demux (block);
+    }
+};
+
+/** Read32_Write32_AVX2_Linear as a Demux, for the suite: it writes the samples into its own buffers instead of dst */
+template<bool REVERSE> class Linear_Demux_Suite : public Demux
+{
+    Read32_Write32_AVX2_Linear<REVERSE> linear;
+    int16_t ** const lin;
+
+public:
+    Linear_Demux_Suite () : lin (allocate_linear ())
+    {
+    }
+
+    ~Linear_Demux_Suite ()
+    {
+        delete_linear (lin);
+    }
+
+    Linear_Demux_Suite (const Linear_Demux_Suite &) = delete;
+    Linear_Demux_Suite & operator = (const Linear_Demux_Suite &) = delete;
+
+    void demux (const byte * src, size_t src_length, byte **) const
+    {
+        linear.demux (src, src_length, lin);
+    }
+};
+
+// the suite reports the kernels by class name, so the two linear adapters get names of their own
+class Read32_Write32_AVX2_Linear_Suite : public Linear_Demux_Suite<false> {};
+class Read32_Write32_AVX2_Linear_Reversed_Suite : public Linear_Demux_Suite<true> {};
+
+/** Runs the kernels BASELINE_REPEATS times, BASELINE_CALLS calls each time. The repetitions go round all
+  * the kernels, so that a slow drift of the machine (thermal throttling, a background job) affects all of them
+  * the same way rather than one kernel. The kernels are those of the main benchmark that the build has;
+  * the ones that do not work as a Demux (In_Place_Demux and the linear ones) run through the adapters above.
+  */
+Suite_Results run_suite ()
+{
+    Reference reference;
+    Write4 write4;
+    Write8 write8;
+    Read4_Write4 r4w4;
+    Read4_Write4_Unroll r4w4_unroll;
+    Read8_Write8 r8w8;
+    Read8_Write8_Unroll r8w8_unroll;
+    Read4_Write4_SSE r4w4_sse;
+    Read4_Write16_SSE r4w16_sse;
+    Read8_Write16_SSE r8w16_sse;
+    Read8_Write16_SSE_Unroll r8w16_sse_unroll;
+    Read16_Write16_SSE r16w16_sse;
+    Read16_Write16_SSE_Unroll r16w16_sse_unroll;
+    Read4_Write32_AVX r4w32_avx;
+    Read8_Write32_AVX r8w32_avx;
+    Read8_Write32_AVX_Unroll r8w32_avx_unroll;
+    Read16_Write8_SSE2_Unroll r16w8_sse2_unroll;
+    Read32_Write32_AVX2_Unroll r32w32_avx2_unroll;
+    Read16_Write16_SSE2_Unroll r16w16_sse2_unroll;
+    Read32_Write32_AVX2_Unpack_Unroll r32w32_avx2_unpack_unroll;
+    Read16_Write16_Vec_Unroll r16w16_vec_unroll;
+    Read32_Write32_Vec_Unroll r32w32_vec_unroll;
+#ifdef __AVX512BW__
+    Read32_Write32_Vec512_Unroll r32w32_vec512_unroll;
+#endif
+    Activity activity;
+    Read16_Write16_SSE_Activity r16w16_sse_activity (activity);
+    Read32_Write32_AVX2_Activity r32w32_avx2_activity (activity);
+    Read32_Write32_AVX2_Energy r32w32_avx2_energy (activity);
+    In_Place_Demux_Suite in_place;
+    Read16_Write16_SSE_Reverse_Unroll r16w16_sse_reverse_unroll;
+    Read32_Write32_AVX2_Reverse_Unroll r32w32_avx2_reverse_unroll;
+    Read32_Write32_AVX2_Linear_Suite r32w32_avx2_linear;
+    Read32_Write32_AVX2_Linear_Reversed_Suite r32w32_avx2_linear_reversed;
+    Copy_AVX copy_avx;
+    const Demux * kernels [] = {
+        &reference, &write4, &write8, &r4w4, &r4w4_unroll, &r8w8, &r8w8_unroll, &r4w4_sse, &r4w16_sse, &r8w16_sse,
+        &r8w16_sse_unroll, &r16w16_sse, &r16w16_sse_unroll, &r4w32_avx, &r8w32_avx, &r8w32_avx_unroll,
+        &r16w8_sse2_unroll, &r32w32_avx2_unroll, &r16w16_sse2_unroll, &r32w32_avx2_unpack_unroll,
+        &r16w16_vec_unroll, &r32w32_vec_unroll,
+#ifdef __AVX512BW__
+        &r32w32_vec512_unroll,
+#endif
+        &r16w16_sse_activity, &r32w32_avx2_activity, &r32w32_avx2_energy, &in_place,
+        &r16w16_sse_reverse_unroll, &r32w32_avx2_reverse_unroll, &r32w32_avx2_linear, &r32w32_avx2_linear_reversed,
+        &copy_avx
+    };
+    const size_t num_kernels = sizeof (kernels) / sizeof (kernels [0]);
+
+    Suite_Results results;
+    results.cpu = cpu_model ();
+    results.compiler = compiler_version ();
+    results.geometry = geometry ();
+    results.kernels.resize (num_kernels);
+    for (size_t k = 0; k < num_kernels; k++) {
+        results.kernels [k].name = typeid (*kernels [k]).name ();
+    }
+    const double ratio = ticks_per_ns ();
+    for (unsigned r = 0; r < BASELINE_REPEATS; r++) {
+        for (size_t k = 0; k < num_kernels; k++) {
+            uint64_t t0 = timestamp ();
+            for (unsigned i = 0; i < BASELINE_CALLS; i++) {
+                kernels [k]->demux (src, SRC_SIZE, dst);
+            }
+            results.kernels [k].times.push_back ((double) (timestamp () - t0) / ratio / BASELINE_CALLS);
+        }
+    }
+    return results;
+}
+
+/** Writes the results as text: the lines "cpu", "compiler", "geometry", and "kernel <name> <times>" */
+bool save_results (const char * file, const Suite_Results & results)
+{
+    FILE * f = fopen (file, "w");
+    if (! f) {
+        perror (file);
+        return false;
+    }
+    fprintf (f, "cpu %s\ncompiler %s\ngeometry %s\n", results.cpu.c_str (), results.compiler.c_str (), results.geometry.c_str ());
+    for (const Kernel_Times & k : results.kernels) {
+        fprintf (f, "kernel %s", k.name.c_str ());
+        for (double t : k.times) fprintf (f, " %.3f", t);
+        fprintf (f, "\n");
+    }
+    if (fclose (f) != 0) {
+        perror (file);
+        return false;
+    }
+    return true;
+}
+
+bool load_results (const char * file, Suite_Results & results)
+{
+    FILE * f = fopen (file, "r");
+    if (! f) {
+        perror (file);
+        return false;
+    }
+    char line [4096];
+    while (fgets (line, sizeof (line), f)) {
+        string s (line);
+        if (! s.empty () && s [s.size () - 1] == '\n') s.erase (s.size () - 1);
+        size_t space = s.find (' ');
+        string key = s.substr (0, space);
+        string value = space == string::npos ? "" : s.substr (space + 1);
+        if (key == "cpu") {
+            results.cpu = value;
+        } else if (key == "compiler") {
+            results.compiler = value;
+        } else if (key == "geometry") {
+            results.geometry = value;
+        } else if (key == "kernel") {
+            istringstream in (value);
+            Kernel_Times k;
+            double t;
+            in >> k.name;
+            while (in >> t) k.times.push_back (t);
+            results.kernels.push_back (k);
+        }
+    }
+    fclose (f);
+    if (results.kernels.empty ()) {
+        cout << file << ": no results\n";
+        return false;
+    }
+    return true;
+}
+
+double median (vector<double> x)
+{
+    sort (x.begin (), x.end ());
+    size_t n = x.size ();
+    return n == 0 ? 0 : n % 2 ? x [n / 2] : (x [n / 2 - 1] + x [n / 2]) / 2;
+}
+
+/** The Mann-Whitney U test, with the normal approximation (good enough from about 8 samples each). Being based
+  * on ranks only, it does not care about the distribution of the times, which is far from normal, with a long tail.
+  * @return z score: positive if the current times tend to be larger than the baseline ones
+  */
+double mann_whitney_z (const vector<double> & baseline, const vector<double> & current)
+{
+    double u = 0;
+    for (double c : current) {
+        for (double b : baseline) {
+            u += c > b ? 1 : c == b ? 0.5 : 0;
+        }
+    }
+    double n1 = (double) baseline.size (), n2 = (double) current.size ();
+    double sd = sqrt (n1 * n2 * (n1 + n2 + 1) / 12);
+    return sd == 0 ? 0 : (u - n1 * n2 / 2) / sd;
+}
+
+/** Runs the suite and compares it with the baseline. A kernel has regressed if its median time has grown
+  * by more than the threshold, and the difference is significant (z above REGRESSION_Z).
+  * @param threshold  the allowed slowdown, percent
+  * Kernels of the baseline that the current run does not have (such as Read32_Write32_Vec512_Unroll of an AVX-512
+  * build in an AVX2 one) are listed, but are not regressions.
+  * @return 0 if there are no regressions, 1 if there are some, 2 if the baseline could not be read or is empty
+  */
+int compare_results (const char * file, double threshold)
+{
+    Suite_Results baseline;
+    if (! load_results (file, baseline)) return 2;
+    Suite_Results current = run_suite ();
+
+    if (baseline.cpu != current.cpu) cout << "CPU differs: " << baseline.cpu << " in the baseline\n";
+    if (baseline.compiler != current.compiler) cout << "Compiler differs: " << baseline.compiler << " in the baseline\n";
+    if (baseline.geometry != current.geometry) cout << "Geometry differs: " << baseline.geometry << " in the baseline\n";
+
+    cout << left << setw (40) << "Kernel" << right << setw (14) << "baseline, ns" << setw (14) << "current, ns"
+         << setw (10) << "change" << setw (8) << "z" << "\n";
+    int regressions = 0;
+    for (const Kernel_Times & k : current.kernels) {
+        double now = median (k.times);
+        cout << left << setw (40) << k.name << right << fixed << setprecision (1);
+        const Kernel_Times * base = NULL;
+        for (const Kernel_Times & b : baseline.kernels) {
+            if (b.name == k.name) base = &b;
+        }
+        if (! base || base->times.empty ()) {
+            cout << setw (14) << "-" << setw (14) << now << "    not in the baseline\n";
+            continue;
+        }
+        double before = median (base->times);
+        double change = (now / before - 1) * 100;
+        double z = mann_whitney_z (base->times, k.times);
+        cout << setw (14) << before << setw (14) << now << setw (9) << showpos << change << "%" << noshowpos
+             << setw (8) << setprecision (2) << z;
+        if (change > threshold && z > REGRESSION_Z) {
+            cout << "  REGRESSION";
+            ++ regressions;
+        } else if (change < -threshold && z < -REGRESSION_Z) {
+            cout << "  faster";
+        }
+        cout << "\n";
+    }
+    cout.unsetf (ios::floatfield);
+    cout << setprecision (6);
+    for (const Kernel_Times & b : baseline.kernels) {
+        bool found = false;
+        for (const Kernel_Times & k : current.kernels) {
+            if (k.name == b.name) found = true;
+        }
+        if (! found) cout << "Warning: " << b.name << " is in the baseline, but not in this run\n";
+    }
+    if (regressions) {
+        cout << regressions << " kernel(s) slower by more than " << threshold << "%\n";
+        return 1;
+    }
+    cout << "No regressions\n";
+    return 0;
+}
+
+// ------- Long blocks
+
+static const size_t LONG_SIZES [] = {64, 256, 1024, 4096, 8000, 16384, 65536};
+static const size_t LONG_TOTAL = (size_t) 2048 * 1024 * 1024;    // source bytes per measurement
+
+/** @return time, in milliseconds, of demultiplexing LONG_TOTAL bytes in blocks of the given number of frames */
+template<class D> uint64_t run_long (const D & demux, const byte * src, size_t frames, byte * const * dst)
+{
+    const size_t calls = LONG_TOTAL / (frames * NUM_TIMESLOTS);
+    uint64_t t0 = currentTimeMillis ();
+    for (size_t i = 0; i < calls; i++) {
+        demux.demux (src, frames, dst);
+    }
+    return currentTimeMillis () - t0;
+}
+
+template<class D> void check_long (const D & demux, const byte * src, size_t frames, byte * const * dst)
+{
+    demux.demux (src, frames, dst);
+    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+        for (size_t f = 0; f < frames; f++) {
+            if (dst [i][f] != src [f * NUM_TIMESLOTS + i]) {
+                cout << typeid (demux).name () << ": results not equal for " << frames << " frames, line " << i << "\n";
+                exit (1);
+            }
+        }
+    }
+}
+
+/** Compares Swept and Tiled drivers for blocks of 64 to 64K frames (DST_SIZE of the fixed size kernels is 64) */
+void measure_long ()
+{
+    const size_t max_frames = LONG_SIZES [sizeof (LONG_SIZES) / sizeof (LONG_SIZES [0]) - 1];
+    byte * src = (byte *) _mm_malloc (max_frames * NUM_TIMESLOTS, 64);
+    srand (0);
+    for (size_t i = 0; i < max_frames * NUM_TIMESLOTS; i++) src [i] = (byte) (rand () % 256);
+    byte * dst [NUM_TIMESLOTS];
+    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+        dst [i] = (byte *) _mm_malloc (max_frames, 64);
+    }
+
+    const Swept<Block_16x16_SSE> swept_16x16;
+    const Swept<Block_32x32_AVX2> swept_32x32;
+    const Tiled<Block_16x16_SSE> tiled_16x16;
+    const Tiled<Block_32x8_AVX> tiled_32x8;
+    const Tiled<Block_32x32_AVX2> tiled_32x32;
+
+    for (size_t frames : LONG_SIZES) {
+        check_long (swept_16x16, src, frames, dst);
+        check_long (swept_32x32, src, frames, dst);
+        check_long (tiled_16x16, src, frames, dst);
+        check_long (tiled_32x8, src, frames, dst);
+        check_long (tiled_32x32, src, frames, dst);
+        cout << "Block of " << frames << " frames:"
+             << " swept 16x16: " << run_long (swept_16x16, src, frames, dst)
+             << "; swept 32x32: " << run_long (swept_32x32, src, frames, dst)
+             << "; tiled 16x16: " << run_long (tiled_16x16, src, frames, dst)
+             << "; tiled 32x8: " << run_long (tiled_32x8, src, frames, dst)
+             << "; tiled 32x32: " << run_long (tiled_32x32, src, frames, dst) << endl;
+    }
+
+    _mm_free (src);
+    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+        _mm_free (dst [i]);
+    }
+}
+
+// ------- Geometry sweep
+
+// NUM_TIMESLOTS and DST_SIZE are constants, and so are the fixed size kernels. Other geometries are measured with
+// the register blocks driven by Swept, which takes the number of timeslots as a template argument and the number
+// of frames at run time. A register block supports a geometry if its width divides the number of timeslots
+// (this also keeps the loads of the blocks that need aligned loads aligned); the blocks that do not are skipped.
+
+static const size_t SWEEP_FRAMES [] = {40, 64, 160, 8000};
+static const size_t SWEEP_TOTAL = (size_t) 256 * 1024 * 1024;  // source bytes per measurement
+
+/** Copies the source of every timeslot as if it was already demultiplexed: the bandwidth limit for the geometry.
+  * The tail of a channel that is not a multiple of 32 bytes is copied with one more 32-byte move, overlapping
+  * the previous one, so that the copy stays a bandwidth limit for odd block sizes too.
+  */
+template<size_t TIMESLOTS> class Copy_Frames
+{
+public:
+    void demux (const byte * src, size_t frames, byte * const * dst) const
+    {
+        if (frames < 32) {
+            for (size_t i = 0; i < TIMESLOTS; i++) {
+                memcpy (dst [i], src + i * frames, frames);
+            }
+            return;
+        }
+        const size_t end = frames / 32 * 32;
+        for (size_t i = 0; i < TIMESLOTS; i++) {
+            const byte * s = src + i * frames;
+            for (size_t f = 0; f < end; f += 32) {
+                _mm256_storeu_si256 ((__m256i *) (dst [i] + f), _mm256_loadu_si256 ((const __m256i *) (s + f)));
+            }
+            if (end != frames) {
+                _mm256_storeu_si256 ((__m256i *) (dst [i] + frames - 32), _mm256_loadu_si256 ((const __m256i *) (s + frames - 32)));
+            }
+        }
+    }
+};
+
+/** @return time, in nanoseconds, of demultiplexing SWEEP_TOTAL bytes (at least one block) */
+template<class D> double run_sweep (const D & demux, const byte * src, size_t frames, size_t timeslots, byte * const * dst)
+{
+    const size_t calls = max ((size_t) 1, SWEEP_TOTAL / (frames * timeslots));
+    const double ratio = ticks_per_ns ();
+    uint64_t t0 = timestamp ();
+    for (size_t i = 0; i < calls; i++) {
+        demux.demux (src, frames, dst);
+    }
+    return (double) (timestamp () - t0) / ratio;
+}
+
+template<size_t TIMESLOTS, class B>
+void sweep_block (const char * name, const byte * src, size_t frames, byte * const * dst, double copy_ns, std::true_type)
+{
+    const Swept<B, TIMESLOTS> demux;
+    demux.demux (src, frames, dst);
+    for (size_t i = 0; i < TIMESLOTS; i++) {
+        for (size_t f = 0; f < frames; f++) {
+            if (dst [i][f] != src [f * TIMESLOTS + i]) {
+                cout << name << ": results not equal for " << TIMESLOTS << " x " << frames << ", line " << i << "\n";
+                exit (1);
+            }
+        }
+    }
+    double ns = run_sweep (demux, src, frames, TIMESLOTS, dst);
+    const size_t calls = max ((size_t) 1, SWEEP_TOTAL / (frames * TIMESLOTS));
+    cout << "    " << left << setw (34) << name << right << fixed << setprecision (2)
+         << setw (8) << (double) calls * frames * TIMESLOTS * 8 / ns << " Gbit/s, "
+         << setw (5) << copy_ns / ns << " of Copy_AVX" << (frames % B::FRAMES ? " (byte tail)" : "") << "\n";
+    cout.unsetf (ios::floatfield);
+    cout << setprecision (6);
+}
+
+template<size_t TIMESLOTS, class B>
+void sweep_block (const char *, const byte *, size_t, byte * const *, double, std::false_type)
+{
+}
+
+template<size_t TIMESLOTS, class B> void sweep_block (const char * name, const byte * src, size_t frames, byte * const * dst, double copy_ns)
+{
+    sweep_block<TIMESLOTS, B> (name, src, frames, dst, copy_ns, std::integral_constant<bool, TIMESLOTS % B::TIMESLOTS == 0> ());
+}
+
+/** Measures the register blocks that support TIMESLOTS timeslots, for blocks of the given numbers of frames */
+template<size_t TIMESLOTS> void sweep_timeslots (const vector<size_t> & sizes)
+{
+    const size_t max_frames = *max_element (sizes.begin (), sizes.end ());
+    byte * src = (byte *) _mm_malloc (max_frames * TIMESLOTS, 64);
+    srand (0);
+    for (size_t i = 0; i < max_frames * TIMESLOTS; i++) src [i] = (byte) (rand () % 256);
+    byte * dst [TIMESLOTS];
+    for (size_t i = 0; i < TIMESLOTS; i++) {
+        dst [i] = (byte *) _mm_malloc (max_frames, 64);
+    }
+
+    for (size_t frames : sizes) {
+        const Copy_Frames<TIMESLOTS> copy;
+        const double copy_ns = run_sweep (copy, src, frames, TIMESLOTS, dst);
+        const size_t calls = max ((size_t) 1, SWEEP_TOTAL / (frames * TIMESLOTS));
+        cout << TIMESLOTS << " timeslots x " << frames << " frames: Copy_AVX "
+             << (uint64_t) ((double) calls * frames * TIMESLOTS * 8 / copy_ns) << " Gbit/s\n";
+        sweep_block<TIMESLOTS, Block_4x4_Scalar> ("Block_4x4_Scalar, swept", src, frames, dst, copy_ns);
+        sweep_block<TIMESLOTS, Block_8x8_SWAR> ("Block_8x8_SWAR, swept", src, frames, dst, copy_ns);
+        sweep_block<TIMESLOTS, Block_16x8_SSE> ("Block_16x8_SSE, swept", src, frames, dst, copy_ns);
+        sweep_block<TIMESLOTS, Block_32x8_AVX> ("Block_32x8_AVX, swept", src, frames, dst, copy_ns);
+        sweep_block<TIMESLOTS, Block_8x16_SSE2> ("Block_8x16_SSE2, swept", src, frames, dst, copy_ns);
+        sweep_block<TIMESLOTS, Block_16x16_SSE> ("Block_16x16_SSE, swept", src, frames, dst, copy_ns);
+        sweep_block<TIMESLOTS, Block_16x16_SSE2> ("Block_16x16_SSE2, swept", src, frames, dst, copy_ns);
+        sweep_block<TIMESLOTS, Block_32x32_AVX2> ("Block_32x32_AVX2, swept", src, frames, dst, copy_ns);
+        sweep_block<TIMESLOTS, Block_32x32_AVX2_Unpack> ("Block_32x32_AVX2_Unpack, swept", src, frames, dst, copy_ns);
+    }
+
+    _mm_free (src);
+    for (size_t i = 0; i < TIMESLOTS; i++) {
+        _mm_free (dst [i]);
+    }
+}
+
+/** Measures T1 (24 timeslots) and E1 (32 timeslots) frames in blocks of the given numbers of frames.
+  * Another number of timeslots is one more sweep_timeslots call.
+  */
+void measure_sweep (const vector<size_t> & sizes)
+{
+    sweep_timeslots<24> (sizes);
+    sweep_timeslots<32> (sizes);
+}
+
+#ifdef __linux__
+
+// ------- Several links on NUMA nodes
+
+static const size_t LINK_BLOCKS = 8192;     // source and channel buffers of a link take 16 MB each
+static const unsigned LINK_ITERATIONS = ITERATIONS / 4;
+
+/** The buffers of one E1 link: captured blocks and the channel buffers, filled consecutively as in Stream_Demux */
+struct Link
+{
+    Arena * arena;
+    byte * src;
+    byte * channels [NUM_TIMESLOTS];
+};
+
+/** Assigns links to NUMA nodes. A link goes to the node of its device; the links with unknown nodes
+  * (or nodes that are not online) are given to the least loaded nodes.
+  * @param link_nodes  node of every link's device, -1 if not known
+  * @param nodes       the online nodes (numa_nodes ())
+  * @return the index in nodes of the node for every link
+  */
+vector<size_t> assign_links (const vector<int> & link_nodes, const vector<int> & nodes)
+{
+    vector<size_t> load (nodes.size (), 0);
+    vector<size_t> assigned;
+    for (int node : link_nodes) {
+        size_t k = find (nodes.begin (), nodes.end (), node) - nodes.begin ();
+        if (k < nodes.size ()) ++ load [k];
+        assigned.push_back (k);
+    }
+    for (size_t & k : assigned) {
+        if (k == nodes.size ()) {
+            k = min_element (load.begin (), load.end ()) - load.begin ();
+            ++ load [k];
+        }
+    }
+    return assigned;
+}
+
+/** Demultiplexes LINK_ITERATIONS blocks of every link. Every node runs as many worker threads as it has links,
+  * up to the number of its CPUs; each worker is pinned to its own CPU of the node and takes every k-th link of it.
+  * @param assigned  the node (index in nodes) of every link
+  * @param remote    allocate the buffers of every link on the next node rather than on its own node
+  * @return time in milliseconds
+  */
+uint64_t run_links (const Demux & demux, const vector<size_t> & assigned, const vector<int> & nodes, bool remote)
+{
+    const size_t capacity = LINK_BLOCKS * DST_SIZE;
+    vector<Link> links (assigned.size ());
+    for (size_t i = 0; i < links.size (); i++) {
+        Link & link = links [i];
+        int node = nodes [remote ? (assigned [i] + 1) % nodes.size () : assigned [i]];
+        link.arena = new Arena (LINK_BLOCKS * SRC_SIZE + NUM_TIMESLOTS * (capacity + 64) + 4096, node);
+        link.src = allocate_in_arena (* link.arena, LINK_BLOCKS * SRC_SIZE, link.channels, capacity, 64);
+        if (! link.arena->bound ()) {
+            cout << "Link " << i << ": cannot bind the buffers to node " << node << ", they follow the default policy\n";
+        }
+        memset (link.src, 0x55, LINK_BLOCKS * SRC_SIZE);
+        for (size_t j = 0; j < NUM_TIMESLOTS; j++) {
+            memset (link.channels [j], 0, capacity);
+        }
+    }
+
+    vector<vector<size_t>> node_links (nodes.size ());
+    for (size_t i = 0; i < links.size (); i++) {
+        node_links [assigned [i]].push_back (i);
+    }
+
+    uint64_t t0 = currentTimeMillis ();
+    vector<thread> threads;
+    for (size_t n = 0; n < nodes.size (); n++) {
+        const vector<int> cpus = numa_node_cpus (nodes [n]);
+        const size_t workers = min (node_links [n].size (), max (cpus.size (), (size_t) 1));
+        for (size_t w = 0; w < workers; w++) {
+            threads.push_back (thread ([&, n, w, workers, cpus] () {
+                if (! cpus.empty ()) pin_thread (vector<int> (1, cpus [w]));
+                for (size_t k = w; k < node_links [n].size (); k += workers) {
+                    const Link & link = links [node_links [n][k]];
+                    run_channels (demux, link.src, link.channels, capacity, LINK_ITERATIONS);
+                }
+            }));
+        }
+    }
+    for (size_t i = 0; i < threads.size (); i++) {
+        threads [i].join ();
+    }
+    uint64_t t = currentTimeMillis () - t0;
+
+    for (size_t i = 0; i < links.size (); i++) {
+        delete links [i].arena;
+    }
+    return t;
+}
+
+/** Demultiplexes the links of the given devices (or two links per node), with the buffers on the workers' nodes
+  * and, if there is more than one node, on other nodes
+  * @param devices  sysfs directories of the devices, such as /sys/class/net/eth0/device; one link per device
+  */
+void measure_numa (const vector<string> & devices)
+{
+    const vector<int> nodes = numa_nodes ();
+    vector<int> link_nodes;
+    if (devices.empty ()) {
+        for (int node : nodes) {
+            link_nodes.push_back (node);
+            link_nodes.push_back (node);
+        }
+    }
+    for (size_t i = 0; i < devices.size (); i++) {
+        link_nodes.push_back (device_numa_node (devices [i]));
+    }
+    vector<size_t> assigned = assign_links (link_nodes, nodes);
+    for (size_t i = 0; i < assigned.size (); i++) {
+        cout << "Link " << i;
+        if (! devices.empty ()) cout << " (" << devices [i] << ", node " << link_nodes [i] << ")";
+        cout << ": worker on node " << nodes [assigned [i]] << endl;
+    }
+
+    const Read16_Write16_SSE_Unroll demux;
+    double bytes = (double) assigned.size () * LINK_ITERATIONS * SRC_SIZE;
+    uint64_t t = run_links (demux, assigned, nodes, false);
+    cout << nodes.size () << " node(s), local buffers: " << t << " ms, "
+         << (uint64_t) (bytes / 1000 / (t ? t : 1)) << " MB/s" << endl;
+    if (nodes.size () == 1) {
+        cout << "Only one node: remote buffers not measured" << endl;
+        return;
+    }
+    t = run_links (demux, assigned, nodes, true);
+    cout << nodes.size () << " node(s), remote buffers: " << t << " ms, "
+         << (uint64_t) (bytes / 1000 / (t ? t : 1)) << " MB/s" << endl;
+}
+
+#endif
+
+static const unsigned TONE_ITERATIONS = 20000;
+
+/** Generates a source block sequence where every even timeslot carries a DTMF digit and every odd one is idle */
+byte * generate_tones (size_t blocks)
+{
+    byte * buf = (byte*) _mm_malloc (SRC_SIZE * blocks, 32);
+    for (size_t n = 0; n < DST_SIZE * blocks; n++) {
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            byte b = 0xD5;
+            if (i % 2 == 0) {
+                size_t key = i / 2 % 16;
+                float row = DTMF_FREQ [key / 4], col = DTMF_FREQ [key % 4 + 4];
+                float x = 8000 * (sin (2 * M_PI * row * n / SAMPLE_RATE) + sin (2 * M_PI * col * n / SAMPLE_RATE));
+                b = linear_to_alaw ((int) x);
+            }
+            buf [n * NUM_TIMESLOTS + i] = b;
+        }
+    }
+    return buf;
+}
+
+const uint32_t EVEN_TIMESLOTS = 0x55555555;
+
+void check_tones (const Goertzel_State & detector)
+{
+    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+        size_t key = i / 2 % 16;
+        char expected = i % 2 == 0 ? DTMF_DIGITS [key / 4][key % 4] : 0;
+        if (detector.digit (i) != expected) {
+            cout << "Tones not detected: timeslot " << i << "\n";
+            exit (1);
+        }
+    }
+}
+
+void report_tones (const char * name, uint64_t t, size_t channels)
+{
+    double audio_seconds = (double) TONE_ITERATIONS * DST_SIZE / SAMPLE_RATE;
+    cout << name << ": " << t << "; channels per core: " << (uint64_t) (channels * audio_seconds * 1000 / (t ? t : 1)) << endl;
+}
+
+/** Runs the scalar and the AVX tone detectors on all timeslots and on the even (non-idle) ones only */
+void measure_tones ()
+{
+    const size_t blocks = 3;
+    byte * tones = generate_tones (blocks);
+    byte ** tone_dst = allocate_dst ();
+
+    Goertzel scalar;
+    Goertzel_AVX avx;
+    for (size_t j = 0; j < blocks; j++) {
+        Reference ().demux (tones + j * SRC_SIZE, SRC_SIZE, tone_dst);
+        scalar.process (tone_dst);
+        avx.process (tone_dst, EVEN_TIMESLOTS);
+    }
+    check_tones (scalar);
+    check_tones (avx);
+
+    uint32_t masks [2] = {0xFFFFFFFF, EVEN_TIMESLOTS};
+    for (size_t m = 0; m < 2; m++) {
+        size_t channels = __builtin_popcount (masks [m]);
+
+        uint64_t t0 = currentTimeMillis ();
+        for (unsigned i = 0; i < TONE_ITERATIONS; i++) {
+            scalar.process (tone_dst, masks [m]);
+        }
+        report_tones (m == 0 ? "Goertzel, all" : "Goertzel, active", currentTimeMillis () - t0, channels);
+
+        t0 = currentTimeMillis ();
+        for (unsigned i = 0; i < TONE_ITERATIONS; i++) {
+            avx.process (tone_dst, masks [m]);
+        }
+        report_tones (m == 0 ? "Goertzel_AVX, all" : "Goertzel_AVX, active", currentTimeMillis () - t0, channels);
+    }
+    _mm_free (tones);
+    delete_dst (tone_dst);
+}
+
+#endif
+
+/** Checks Incremental_Demux against Reference, feeding the frames in pieces of 1 to 11 frames, with some flushes */
+void check_incremental ()
+{
+    byte * src = generate ();
+    byte ** dst0 = allocate_dst ();
+    byte ** dst = allocate_dst ();
+    Reference ().demux (src, SRC_SIZE, dst0);
+
+    Incremental_Demux inc (dst, DST_SIZE);
+    for (size_t pos = 0, n = 1; pos < DST_SIZE; pos += n, n = n % 11 + 1) {
+        n = min (n, DST_SIZE - pos);
+        inc.write (src + pos * NUM_TIMESLOTS, n);
+        if (n == 5) inc.flush ();
+    }
+    inc.flush ();
+
+    for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+        if (memcmp (dst0[i], dst[i], DST_SIZE)) {
+            cout << "Incremental results not equal: line " << i << "\n";
+            exit (1);
+        }
+    }
+    _mm_free (src);
+    delete_dst (dst0);
+    delete_dst (dst);
+}
+
+/** Feeds the source block to Incremental_Demux in pieces of 1, 2, 4 and 8 frames, and reports time per frame */
+void measure_incremental ()
+{
+    check_incremental ();
+
+    for (size_t n = 1; n <= 8; n *= 2) {
+        Incremental_Demux inc (dst, DST_SIZE);
+        uint64_t t0 = currentTimeMillis ();
+        for (unsigned i = 0; i < ITERATIONS; i++) {
+            for (size_t pos = 0; pos < DST_SIZE; pos += n) {
+                inc.write (src + pos * NUM_TIMESLOTS, n);
+            }
+            inc.rewind ();
+        }
+        uint64_t t = currentTimeMillis () - t0;
+        cout << "Incremental_Demux, " << n << " frames: " << t << "; ns per frame: "
+             << t * 1e6 / ((double) ITERATIONS * DST_SIZE) << endl;
+    }
+}
+
+static const unsigned RING_ITERATIONS = 200000;
+static const size_t RING_CAPACITY = 64 * 1024;
+static const size_t RING_CONSUMERS = 2;
+
+/** Per-channel queues guarded by mutexes, filled by copying the demultiplexer output: the baseline for the rings */
+struct Locked_Queue
+{
+    mutex lock;
+    vector<byte> data;
+};
+
+/** Consumes channels consumer, consumer + RING_CONSUMERS, ... until each of them receives total bytes;
+  * adds up all the bytes as a checksum.
+  */
+void consume_rings (Ring_Set & rings, size_t consumer, size_t total, uint64_t & sum)
+{
+    vector<size_t> received (NUM_TIMESLOTS, 0);
+    size_t done = 0;
+    uint64_t s = 0;
+    while (done < NUM_TIMESLOTS / RING_CONSUMERS) {
+        bool idle = true;
+        for (size_t i = consumer; i < NUM_TIMESLOTS; i += RING_CONSUMERS) {
+            if (received [i] == total) continue;
+            size_t length;
+            const byte * p = rings.peek (i, length);
+            if (length == 0) continue;
+            for (size_t j = 0; j < length; j++) s += p [j];
+            rings.release (i, length);
+            idle = false;
+            if ((received [i] += length) == total) ++ done;
+        }
+        if (idle) this_thread::yield ();
+    }
+    sum = s;
+}
+
+void consume_queues (Locked_Queue * queues, size_t consumer, size_t total, uint64_t & sum)
+{
+    vector<size_t> received (NUM_TIMESLOTS, 0);
+    vector<byte> data;
+    size_t done = 0;
+    uint64_t s = 0;
+    while (done < NUM_TIMESLOTS / RING_CONSUMERS) {
+        bool idle = true;
+        for (size_t i = consumer; i < NUM_TIMESLOTS; i += RING_CONSUMERS) {
+            if (received [i] == total) continue;
+            {
+                lock_guard<mutex> guard (queues [i].lock);
+                data.swap (queues [i].data);
+            }
+            if (data.empty ()) continue;
+            for (size_t j = 0; j < data.size (); j++) s += data [j];
+            idle = false;
+            if ((received [i] += data.size ()) == total) ++ done;
+            data.clear ();
+        }
+        if (idle) this_thread::yield ();
+    }
+    sum = s;
+}
+
+uint64_t sum_all (const uint64_t sums [RING_CONSUMERS])
+{
+    uint64_t s = 0;
+    for (size_t c = 0; c < RING_CONSUMERS; c++) s += sums [c];
+    return s;
+}
+
+/** Runs the demultiplexer with RING_CONSUMERS consumer threads, delivering the data via Ring_Set
+  * and via mutex-guarded queues, and verifies the checksums
+  */
+void measure_rings (const Demux & demux)
+{
+    const size_t total = (size_t) RING_ITERATIONS * DST_SIZE;
+    uint64_t expected = 0;
+    for (size_t i = 0; i < SRC_SIZE; i++) expected += src [i];
+    expected *= RING_ITERATIONS;
+
+    uint64_t sums [RING_CONSUMERS];
+    vector<thread> threads;
+
+    Ring_Set rings (NUM_TIMESLOTS, RING_CAPACITY, DST_SIZE);
+    uint64_t t0 = currentTimeMillis ();
+    for (size_t c = 0; c < RING_CONSUMERS; c++) {
+        threads.push_back (thread (consume_rings, ref (rings), c, total, ref (sums [c])));
+    }
+    for (unsigned i = 0; i < RING_ITERATIONS; i++) {
+        while (! demux_to_rings (demux, src, SRC_SIZE, rings)) this_thread::yield ();
+    }
+    for (size_t c = 0; c < RING_CONSUMERS; c++) threads [c].join ();
+    uint64_t t = currentTimeMillis () - t0;
+    if (sum_all (sums) != expected) {
+        cout << "Ring checksum not equal\n";
+        exit (1);
+    }
+    cout << typeid (demux).name() << ", rings: " << t << endl;
+
+    threads.clear ();
+    Locked_Queue * queues = new Locked_Queue [NUM_TIMESLOTS];
+    t0 = currentTimeMillis ();
+    for (size_t c = 0; c < RING_CONSUMERS; c++) {
+        threads.push_back (thread (consume_queues, queues, c, total, ref (sums [c])));
+    }
+    for (unsigned i = 0; i < RING_ITERATIONS; i++) {
+        demux.demux (src, SRC_SIZE, dst);
+        for (size_t j = 0; j < NUM_TIMESLOTS; j++) {
+            lock_guard<mutex> guard (queues [j].lock);
+            queues [j].data.insert (queues [j].data.end (), dst [j], dst [j] + DST_SIZE);
+        }
+    }
+    for (size_t c = 0; c < RING_CONSUMERS; c++) threads [c].join ();
+    t = currentTimeMillis () - t0;
+    if (sum_all (sums) != expected) {
+        cout << "Queue checksum not equal\n";
+        exit (1);
+    }
+    cout << typeid (demux).name() << ", locked queues: " << t << endl;
+    delete[] queues;
+}
+
+#ifdef __linux__
+
+static const size_t SHM_SLOTS = 1024;
+static const size_t SHM_READERS = 2;
+static const char * const SHM_NAME = "/e1-demux-plane";
+
+/** How far the writer of measure_shm may get ahead of the slowest reader, in blocks.
+  * The plane itself never waits for the readers (a real writer runs at the line rate, which they easily keep up
+  * with), but the benchmark writes as fast as it can, and unpaced it overran the readers on about 95% of the blocks.
+  * Half of the slots leaves the readers a margin, so a block is never overwritten while it is being read.
+  */
+static const size_t SHM_AHEAD = SHM_SLOTS / 2;
+
+/** The number of blocks a reader has finished, in memory shared with the writer of measure_shm for pacing */
+struct Shm_Progress
+{
+    alignas (64) atomic<uint64_t> done;
+};
+
+/** A reader process: opens the plane, processes blocks in place (adds up their bytes) until the writer closes it,
+  * reporting its progress after every block (so it keeps going after a wrong checksum, not to stall the writer).
+  * Exits with 1 if any block had a wrong checksum, was overrun or was missed: every block must be delivered.
+  */
+void read_plane (size_t reader, uint64_t expected, uint64_t total, Shm_Progress * progress)
+{
+    Shm_Plane * plane = Shm_Plane::open (SHM_NAME);
+    if (! plane) {
+        perror ("shm_open");
+        exit (1);
+    }
+    uint64_t next = 0;
+    uint64_t blocks = 0, overruns = 0, errors = 0;
+    for (;;) {
+        uint64_t head = plane->head ();
+        if (next == head) {
+            if (plane->closed () && next == plane->head ()) break;
+            this_thread::yield ();
+            continue;
+        }
+        if (head - next > plane->slots ()) {
+            overruns += head - plane->slots () - next;
+            next = head - plane->slots ();
+        }
+        uint64_t sum = 0;
+        for (size_t i = 0; i < plane->channels (); i++) {
+            const byte * p = plane->channel (next, i);
+            for (size_t j = 0; j < plane->channel_size (); j++) sum += p [j];
+        }
+        if (! plane->valid (next)) {
+            ++ overruns;
+        } else if (sum != expected) {
+            ++ errors;
+        } else {
+            ++ blocks;
+        }
+        ++ next;
+        progress [reader].done.store (next, memory_order_release);
+    }
+    delete plane;
+    if (errors != 0) {
+        cout << "reader " << reader << ": plane checksum not equal in " << errors << " blocks\n";
+        exit (1);
+    }
+    if (overruns != 0 || blocks != total) {
+        cout << "reader " << reader << ": blocks " << blocks << " of " << total << ", overruns " << overruns << endl;
+        exit (1);
+    }
+    exit (0);
+}
+
+/** Runs the demultiplexer into a shared memory plane read by SHM_READERS other processes, no more than SHM_AHEAD
+  * blocks ahead of the slowest one, and reports the throughput of the blocks delivered to all the readers
+  */
+void measure_shm (const Demux & demux)
+{
+    uint64_t expected = 0;
+    for (size_t i = 0; i < SRC_SIZE; i++) expected += src [i];
+
+    Shm_Plane * plane = Shm_Plane::create (SHM_NAME, NUM_TIMESLOTS, DST_SIZE, SHM_SLOTS);
+    void * p = mmap (NULL, SHM_READERS * sizeof (Shm_Progress), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (! plane || p == MAP_FAILED) {
+        perror ("shm_open");
+        exit (1);
+    }
+    Shm_Progress * progress = (Shm_Progress *) p;
+    for (size_t r = 0; r < SHM_READERS; r++) new (&progress [r]) Shm_Progress {{0}};
+
+    uint64_t t0 = currentTimeMillis ();
+    pid_t readers [SHM_READERS];
+    for (size_t r = 0; r < SHM_READERS; r++) {
+        readers [r] = fork ();
+        if (readers [r] == 0) read_plane (r, expected, ITERATIONS, progress);
+    }
+    for (unsigned i = 0; i < ITERATIONS; i++) {
+        for (size_t r = 0; r < SHM_READERS; r++) {
+            while (i - progress [r].done.load (memory_order_acquire) >= SHM_AHEAD) this_thread::yield ();
+        }
+        demux_to_plane (demux, src, SRC_SIZE, *plane);
+    }
+    plane->close ();
+
+    bool ok = true;
+    for (size_t r = 0; r < SHM_READERS; r++) {
+        int status;
+        waitpid (readers [r], &status, 0);
+        ok = ok && WIFEXITED (status) && WEXITSTATUS (status) == 0;
+    }
+    uint64_t t = currentTimeMillis () - t0;
+    delete plane;
+    Shm_Plane::remove (SHM_NAME);
+    munmap (p, SHM_READERS * sizeof (Shm_Progress));
+    if (! ok) {
+        cout << typeid (demux).name() << ", shared memory: blocks were not delivered to all the readers\n";
+        exit (1);
+    }
+    cout << typeid (demux).name() << ", shared memory: " << t << " ms, "
+         << (uint64_t) ((double) ITERATIONS * SRC_SIZE / 1000 / (t ? t : 1)) << " MB/s delivered to each of "
+         << SHM_READERS << " readers" << endl;
+}
+
+
+/** Demultiplexes a raw E1 capture file into per-timeslot files using Stream_Kernel, and reports the throughput
+  * @param quiet  do not report the throughput and the ignored incomplete frame (for the self-checks)
+  */
+int demux_file (const char * input, const char * output_prefix, bool quiet = false)
+{
+    int fd = open (input, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat (fd, &st) != 0) {
+        perror (input);
+        return 1;
+    }
+    size_t length = st.st_size;
+    const byte * data = (const byte *) "";
+    if (length != 0) {
+        data = (const byte *) mmap (NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            perror ("mmap");
+            return 1;
+        }
+        madvise ((void *) data, length, MADV_SEQUENTIAL);
+    }
+    close (fd);
+
+    uint64_t t0 = currentTimeMillis ();
+    size_t rest;
+    {
+        Static_Batch<Stream_Kernel> demux;
+        File_Sink sink (output_prefix);
+        Stream_Demux stream (demux, sink);
+        stream.write (data, length);
+        rest = stream.finish ();
+    }
+    uint64_t t = currentTimeMillis () - t0;
+
+    if (length != 0) munmap ((void *) data, length);
+    if (quiet) return 0;
+    if (rest != 0) {
+        cout << "Ignored " << rest << " bytes of an incomplete frame at the end\n";
+    }
+    double seconds = (t ? t : 1) / 1000.0;
+    cout << input << ": " << length << " bytes, " << t << " ms, "
+         << length / seconds / 1e6 << " MB/s, " << length * 8 / seconds / 1e9 << " Gbit/s" << endl;
+    return 0;
+}
+
+
+static const size_t PIPELINE_BUFFERS = 3;
+static const size_t PIPELINE_INPUT_SIZE = 512 * SRC_SIZE;
+
+struct Input_Buffer
+{
+    byte * data;
+    size_t length;
+};
+
+struct Output_Set
+{
+    byte * channels [NUM_TIMESLOTS];
+    size_t length;
+};
+
+/** Passes full output buffers to the writer stage, and gives Stream_Demux a free set to continue with */
+class Pipeline_Sink : public Channel_Sink
+{
+    Buffer_Queue<Output_Set *> & free_sets;
+    Buffer_Queue<Output_Set *> & full_sets;
+
+public:
+    Pipeline_Sink (Buffer_Queue<Output_Set *> & free_sets, Buffer_Queue<Output_Set *> & full_sets)
+        : free_sets (free_sets), full_sets (full_sets)
+    {
+    }
+
+    void write (byte ** channels, size_t length)
+    {
+        Output_Set * set = free_sets.pop ();
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            swap (channels [i], set->channels [i]);
+        }
+        set->length = length;
+        full_sets.push (set);
+    }
+};
+
+void read_stage (int fd, Buffer_Queue<Input_Buffer> & free_inputs, Buffer_Queue<Input_Buffer> & full_inputs)
+{
+    for (;;) {
+        Input_Buffer b = free_inputs.pop ();
+        b.length = 0;
+        while (b.length < PIPELINE_INPUT_SIZE) {
+            ssize_t n = read (fd, b.data + b.length, PIPELINE_INPUT_SIZE - b.length);
+            if (n < 0) {
+                perror ("read");
+                exit (1);
+            }
+            if (n == 0) break;
+            b.length += n;
+        }
+        if (b.length != 0) {
+            full_inputs.push (b);
+        } else {
+            free_inputs.push (b);   // pipeline_file collects all the buffers at the end
+        }
+        if (b.length < PIPELINE_INPUT_SIZE) {
+            Input_Buffer end = {NULL, 0};
+            full_inputs.push (end);
+            return;
+        }
+    }
+}
+
+void write_stage (Channel_Sink & sink, Buffer_Queue<Output_Set *> & free_sets, Buffer_Queue<Output_Set *> & full_sets)
+{
+    for (Output_Set * set; (set = full_sets.pop ()) != NULL; ) {
+        sink.write (set->channels, set->length);
+        free_sets.push (set);
+    }
+}
+
+/** Demultiplexes a capture file like demux_file, but with reading, demultiplexing and writing running
+  * in three threads connected by queues of PIPELINE_BUFFERS pre-allocated buffers each, so that the kernel
+  * runs while the previous output is written and the next input is read
+  * @param quiet  do not report the throughput and the ignored incomplete frame (for the self-checks)
+  */
+int pipeline_file (const char * input, const char * output_prefix, bool quiet = false)
+{
+    int fd = open (input, O_RDONLY);
+    if (fd < 0) {
+        perror (input);
+        return 1;
+    }
+    posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    Buffer_Queue<Input_Buffer> free_inputs, full_inputs;
+    Buffer_Queue<Output_Set *> free_sets, full_sets;
+    Output_Set sets [PIPELINE_BUFFERS];
+    for (size_t j = 0; j < PIPELINE_BUFFERS; j++) {
+        Input_Buffer b = {(byte *) _mm_malloc (PIPELINE_INPUT_SIZE, 32), 0};
+        free_inputs.push (b);
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            sets [j].channels [i] = (byte *) _mm_malloc (STREAM_CAPACITY, 32);
+        }
+        free_sets.push (&sets [j]);
+    }
+
+    uint64_t t0 = currentTimeMillis ();
+    size_t length = 0, rest;
+    {
+        File_Sink file_sink (output_prefix);
+        thread reader (read_stage, fd, ref (free_inputs), ref (full_inputs));
+        thread writer (write_stage, ref (file_sink), ref (free_sets), ref (full_sets));
+
+        Static_Batch<Stream_Kernel> demux;
+        Pipeline_Sink sink (free_sets, full_sets);
+        Stream_Demux stream (demux, sink, STREAM_CAPACITY);
+        for (Input_Buffer b; (b = full_inputs.pop ()).data != NULL; ) {
+            stream.write (b.data, b.length);
+            length += b.length;
+            free_inputs.push (b);
+        }
+        rest = stream.finish ();
+        full_sets.push (NULL);
+        reader.join ();
+        writer.join ();
+
+        // Stream_Demux frees the set it holds; all the others are back in the free queue
+        for (size_t j = 0; j < PIPELINE_BUFFERS; j++) {
+            Output_Set * set = free_sets.pop ();
+            for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+                _mm_free (set->channels [i]);
+            }
+            _mm_free (free_inputs.pop ().data);
+        }
+    }
+    uint64_t t = currentTimeMillis () - t0;
+    close (fd);
+
+    if (quiet) return 0;
+    if (rest != 0) {
+        cout << "Ignored " << rest << " bytes of an incomplete frame at the end\n";
+    }
+    double seconds = (t ? t : 1) / 1000.0;
+    cout << input << ": " << length << " bytes, " << t << " ms, "
+         << length / seconds / 1e6 << " MB/s, " << length * 8 / seconds / 1e9 << " Gbit/s" << endl;
+    return 0;
+}
+/** Runs pipeline_file on captures of several sizes, including an empty one and an exact multiple of
+  * PIPELINE_INPUT_SIZE (where the last read returns nothing), and checks the output files
+  */
+void check_pipeline ()
+{
+    char dir [] = "/tmp/e1-pipeline-XXXXXX";
+    if (! mkdtemp (dir)) {
+        perror ("mkdtemp");
+        exit (1);
+    }
+    string input = string (dir) + "/capture";
+    string prefix = string (dir) + "/out";
+    const size_t sizes [] = {0, PIPELINE_INPUT_SIZE, 2 * PIPELINE_INPUT_SIZE + 1000 * NUM_TIMESLOTS + 5};
+    srand (0);
+    for (size_t length : sizes) {
+        vector<byte> capture (length);
+        for (size_t i = 0; i < length; i++) capture [i] = (byte) (rand () % 256);
+        FILE * f = fopen (input.c_str (), "wb");
+        if (! f || fwrite (capture.data (), 1, length, f) != length || fclose (f) != 0) {
+            perror (input.c_str ());
+            exit (1);
+        }
+        if (pipeline_file (input.c_str (), prefix.c_str (), true) != 0) exit (1);
+
+        size_t frames = length / NUM_TIMESLOTS;
+        for (size_t i = 0; i < NUM_TIMESLOTS; i++) {
+            char name [4096];
+            snprintf (name, sizeof (name), "%s.%02u", prefix.c_str (), (unsigned) i);
+            vector<byte> channel (frames + 1);
+            f = fopen (name, "rb");
+            size_t n = f ? fread (channel.data (), 1, channel.size (), f) : 0;
+            if (f) fclose (f);
+            bool equal = n == frames;
+            for (size_t j = 0; equal && j < frames; j++) {
+                equal = channel [j] == capture [j * NUM_TIMESLOTS + i];
+            }
+            if (! equal) {
+                cout << "pipeline_file: " << length << " bytes: results not equal: line " << i << "\n";
+                exit (1);
+            }
+            unlink (name);
+        }
+    }
+    unlink (input.c_str ());
+    rmdir (dir);
+}
+
+#endif
+
+int main (int argc, char ** argv)
+{
+#ifdef __AVX2__
+    if ((argc == 2 || argc == 3) && ! strcmp (argv [1], "arena")) {
+        long skew = argc == 3 ? atol (argv [2]) : 64;
+        if (skew < 0 || skew % 64 != 0) {
+            cout << "Invalid skew: " << argv [2] << "\n";
+            return 2;
+        }
+        measure_arena ((size_t) skew);
+        return 0;
+    }
+#endif
+    if ((argc == 2 || argc == 3) && ! strcmp (argv [1], "parallel")) {
+        long threads = argc == 3 ? atol (argv [2]) : (long) thread::hardware_concurrency ();
+        if (threads <= 0) {
+            cout << "Invalid number of threads: " << threads << "\n";
+            return 2;
+        }
+        measure_parallel ((unsigned) threads);
+        return 0;
+    }
+#ifdef __AVX2__
+    if (argc >= 2 && argc <= 5 && ! strcmp (argv [1], "latency")) {
+        long group = argc >= 3 ? atol (argv [2]) : 1;
+        if (group <= 0 || group > ITERATIONS) {
+            cout << "Invalid number of calls per sample: " << argv [2] << "\n";
+            return 2;
+        }
+        src = generate ();
+        dst = allocate_dst ();
+        measure_latency ((unsigned) group, argc >= 4 ? atoi (argv [3]) : -1, argc >= 5 ? atoi (argv [4]) : -1);
+        return 0;
+    }
+    if (argc == 3 && ! strcmp (argv [1], "baseline")) {
+        src = generate ();
+        dst = allocate_dst ();
+        Suite_Results results = run_suite ();
+        if (! save_results (argv [2], results)) return 1;
+        for (const Kernel_Times & k : results.kernels) {
+            cout << k.name << ": " << median (k.times) << " ns\n";
+        }
+        return 0;
+    }
+    if ((argc == 3 || argc == 4) && ! strcmp (argv [1], "compare")) {
+        double threshold = argc == 4 ? atof (argv [3]) : 5;
+        if (threshold <= 0) {
+            cout << "Invalid threshold: " << argv [3] << "\n";
+            return 2;
+        }
+        src = generate ();
+        dst = allocate_dst ();
+        return compare_results (argv [2], threshold);
+    }
+    if (argc >= 2 && ! strcmp (argv [1], "sweep")) {
+        vector<size_t> sizes;
+        for (int i = 2; i < argc; i++) {
+            long frames = atol (argv [i]);
+            if (frames <= 0) {
+                cout << "Invalid block size: " << argv [i] << "\n";
+                return 2;
+            }
+            sizes.push_back ((size_t) frames);
+        }
+        if (sizes.empty ()) {
+            sizes.assign (SWEEP_FRAMES, SWEEP_FRAMES + sizeof (SWEEP_FRAMES) / sizeof (SWEEP_FRAMES [0]));
+        }
+        measure_sweep (sizes);
+        return 0;
+    }
+    if (argc == 2 && ! strcmp (argv [1], "tiled")) {
+        measure_long ();
+        return 0;
+    }
+    if (argc >= 2 && ! strcmp (argv [1], "hierarchy")) {
+        vector<size_t> sizes;
+        for (int i = 2; i < argc; i++) {
+            long size = atol (argv [i]);
+            if (size <= 0) {
+                cout << "Invalid working set size: " << argv [i] << "\n";
+                return 2;
+            }
+            sizes.push_back ((size_t) size);
+        }
+        if (sizes.empty ()) {
+            sizes.assign (HIERARCHY_LEVELS, HIERARCHY_LEVELS + sizeof (HIERARCHY_LEVELS) / sizeof (HIERARCHY_LEVELS [0]));
+        }
+        measure_hierarchy (sizes);
+        return 0;
+    }
+#endif
+#ifdef __linux__
+#ifdef __AVX2__
+    if (argc >= 2 && ! strcmp (argv [1], "numa")) {
+        measure_numa (vector<string> (argv + 2, argv + argc));
+        return 0;
+    }
+#endif
+    if (argc == 4 && ! strcmp (argv [1], "demux")) {
+        return demux_file (argv [2], argv [3]);
+    }
+    if (argc == 4 && ! strcmp (argv [1], "pipeline")) {
+        return pipeline_file (argv [2], argv [3]);
+    }
+    if (argc == 2 && ! strcmp (argv [1], "counters")) {
+        counters = new Perf_Counters ();
+        if (! counters->available ()) {
+            cout << "Performance counters are not available (see /proc/sys/kernel/perf_event_paranoid)\n";
+            return 1;
+        }
+    } else
+#endif
+    if (argc != 1) {
+        cout << "Usage: " << argv [0] << "\n"
+             << "           run the benchmarks\n"
+             << "       " << argv [0] << " counters\n"
+             << "           run the benchmarks, printing hardware performance counters per block\n"
+#ifdef __AVX2__
+             << "       " << argv [0] << " hierarchy [<working set, KB> ...]\n"
+             << "           measure the kernels with data coming from L1, L2, L3 and DRAM (or from the given working sets)\n"
+             << "       " << argv [0] << " arena [<skew, bytes>]\n"
+             << "           compare channel buffers from malloc and from an arena, without and with skew (default 64)\n"
+#endif
+             << "       " << argv [0] << " parallel [<threads>]\n"
+             << "           demultiplex one large buffer on 1, 2, 4 ... threads (default: number of CPUs)\n"
+#ifdef __AVX2__
+             << "       " << argv [0] << " latency [<calls per sample> [<cpu> [<load cpu>]]]\n"
+             << "           print percentiles of the time per call, optionally pinned to a CPU, with a busy thread on another one\n"
+             << "       " << argv [0] << " baseline <file>\n"
+             << "           run the benchmark suite several times and save the times as a baseline\n"
+             << "       " << argv [0] << " compare <file> [<threshold, %>]\n"
+             << "           run the suite again and fail if a kernel is significantly slower than in the baseline (default 5%);\n"
+             << "           exit code 1 for a regression, 2 if the baseline cannot be read\n"
+             << "       " << argv [0] << " sweep [<frames> ...]\n"
+             << "           measure the kernels with 24 and 32 timeslots in blocks of 40, 64, 160, 8000 (or the given) frames\n"
+             << "       " << argv [0] << " tiled\n"
+             << "           compare swept and tiled demultiplexing of blocks of 64 to 64K frames\n"
+             << "       " << argv [0] << " numa [<device> ...]\n"
+             << "           demultiplex links of the devices (such as /sys/class/net/eth0/device) on their NUMA nodes\n"
+#endif
+             << "       " << argv [0] << " demux <capture> <output prefix>\n"
+             << "           demultiplex a capture file into prefix.00 .. prefix.31\n"
+             << "       " << argv [0] << " pipeline <capture> <output prefix>\n"
+             << "           same, with reading and writing in separate threads\n";
+        return 2;
+    }
+
+    src = generate ();
+    dst = allocate_dst ();
+
+    measure (Reference ());
+    measure (Write4 ());
+    measure (Write8 ());
+    measure (Read4_Write4 ());
+    check (Read4_Write4_Unroll ());
+    measure (Read4_Write4_Unroll ());
+    check (Read8_Write8 ());
+    measure (Read8_Write8 ());
+    check (Read8_Write8_Unroll ());
+    measure (Read8_Write8_Unroll ());
+#ifdef __SSE4_1__
+    measure (Read4_Write4_SSE ());
+    measure (Read4_Write16_SSE ());
+    measure (Read8_Write16_SSE ());
+    check (Read8_Write16_SSE_Unroll ());
+    measure (Read8_Write16_SSE_Unroll ());
+    check (Read16_Write16_SSE ());
+    measure (Read16_Write16_SSE ());
+    check (Read16_Write16_SSE_Unroll ());
+    measure (Read16_Write16_SSE_Unroll ());
+#endif
+#ifdef __AVX2__
+    measure (Read4_Write32_AVX ());
+    measure (Read8_Write32_AVX ());
+    check (Read8_Write32_AVX_Unroll ());
+    measure (Read8_Write32_AVX_Unroll ());
+#endif
+    check (Read16_Write8_SSE2_Unroll ());
+    measure (Read16_Write8_SSE2_Unroll ());
+#ifdef __AVX2__
+    check (Read32_Write32_AVX2_Unroll ());
+    measure (Read32_Write32_AVX2_Unroll ());
+#endif
+    check (Read16_Write16_SSE2_Unroll ());
+    measure (Read16_Write16_SSE2_Unroll ());
+#ifdef __AVX2__
+    check (Read32_Write32_AVX2_Unpack_Unroll ());
+    measure (Read32_Write32_AVX2_Unpack_Unroll ());
+#endif
+    check (Read16_Write16_Vec_Unroll ());
+    measure (Read16_Write16_Vec_Unroll ());
+#ifdef __AVX__
+    check (Read32_Write32_Vec_Unroll ());
+    measure (Read32_Write32_Vec_Unroll ());
+#endif
+#ifdef __AVX512BW__
+    check (Read32_Write32_Vec512_Unroll ());
+    measure (Read32_Write32_Vec512_Unroll ());
+#endif
+
+#ifdef __SSE4_1__
+    Activity activity;
+    check_activity ();
+    measure (Read16_Write16_SSE_Activity (activity));
+#endif
+#ifdef __AVX2__
+    measure (Read32_Write32_AVX2_Activity (activity));
+    measure (Read32_Write32_AVX2_Energy (activity));
+
+    check_in_place ();
+    measure_in_place ();
+
+    check_select ();
+    measure_select ();
+
+    check_reversed ();
+    measure_reversed ();
+#endif
+
+    check_alignment ();
+    measure_alignment ();
+
+#ifdef __linux__
+    check_pipeline ();
+#endif
+
+    measure (Null ());
+    measure (Copy ());
+#ifdef __AVX2__
+    measure (Copy_AVX ());
+#endif
+
+    measure_static (Read8_Write8 ());
+    measure_static (Read8_Write8_Unroll ());
+#ifdef __SSE4_1__
+    measure_static (Read4_Write4_SSE ());
+    measure_static (Read4_Write16_SSE ());
+    measure_static (Read8_Write16_SSE ());
+    measure_static (Read8_Write16_SSE_Unroll ());
+    measure_static (Read16_Write16_SSE ());
+    measure_static (Read16_Write16_SSE_Unroll ());
+#endif
+#ifdef __AVX2__
+    measure_static (Read4_Write32_AVX ());
+    measure_static (Read8_Write32_AVX ());
+    measure_static (Read8_Write32_AVX_Unroll ());
+#endif
+    measure_static (Read16_Write8_SSE2_Unroll ());
+#ifdef __AVX2__
+    measure_static (Read32_Write32_AVX2_Unroll ());
+#endif
+    measure_static (Read16_Write16_SSE2_Unroll ());
+#ifdef __AVX2__
+    measure_static (Read32_Write32_AVX2_Unpack_Unroll ());
+#endif
+    measure_static (Read16_Write16_Vec_Unroll ());
+#ifdef __AVX__
+    measure_static (Read32_Write32_Vec_Unroll ());
+#endif
+#ifdef __AVX512BW__
+    measure_static (Read32_Write32_Vec512_Unroll ());
+#endif
+#ifdef __AVX2__
+    measure_static (Copy_AVX ());
+#endif
+
+    measure_incremental ();
+#ifdef __AVX2__
+    measure_tones ();
+#endif
+    measure_rings (Stream_Kernel ());
+#ifdef __linux__
+    measure_shm (Stream_Kernel ());
+#endif
 
     return 0;
 }
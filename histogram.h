@@ -0,0 +1,78 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cmath>
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+/** A histogram of latencies with logarithmic buckets, in the style of HdrHistogram. Values below 128 are counted
+  * exactly; every higher range between two powers of two is divided into 64 equal buckets, so a value reported
+  * from a bucket is within 1.6% of the values recorded in it.
+  * Recording is a few instructions and never allocates, so it can be done between the calls being timed.
+  */
+class Latency_Histogram
+{
+    static const unsigned SUB_BITS = 7;
+    static const size_t SUB = (size_t) 1 << SUB_BITS;     // values counted exactly
+    static const size_t HALF = SUB / 2;                   // buckets per power of two above them
+
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t max_value;
+
+    static size_t index (uint64_t v)
+    {
+        if (v < SUB) return (size_t) v;
+        unsigned top = 63 - __builtin_clzll (v);          // at least SUB_BITS
+        unsigned shift = top - (SUB_BITS - 1);            // v >> shift is in [HALF, SUB)
+        return SUB + (top - SUB_BITS) * HALF + (size_t) ((v >> shift) - HALF);
+    }
+
+    /** @return the largest value that goes to bucket i */
+    static uint64_t upper (size_t i)
+    {
+        if (i < SUB) return i;
+        size_t k = i - SUB;
+        unsigned shift = (unsigned) (k / HALF) + 1;
+        return ((uint64_t) (k % HALF + HALF + 1) << shift) - 1;
+    }
+
+public:
+    Latency_Histogram () : counts (SUB + (64 - SUB_BITS) * HALF, 0), total (0), max_value (0) {}
+
+    void record (uint64_t v)
+    {
+        ++ counts [index (v)];
+        ++ total;
+        if (v > max_value) max_value = v;
+    }
+
+    uint64_t count () const
+    {
+        return total;
+    }
+
+    uint64_t max () const
+    {
+        return max_value;
+    }
+
+    /** @return the value at or below which the fraction q of the recorded values are
+      * (the top of the bucket where that value was counted, but not above the maximum)
+      */
+    uint64_t percentile (double q) const
+    {
+        if (total == 0) return 0;
+        uint64_t rank = (uint64_t) ceil (q * (double) total);
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size (); i++) {
+            seen += counts [i];
+            if (seen >= rank) return upper (i) < max_value ? upper (i) : max_value;
+        }
+        return max_value;
+    }
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+/** NUMA topology from /sys/devices/system/node, without libnuma.
+  * A system without the node directory (or a kernel without NUMA) looks like one node with all the CPUs.
+  */
+
+/** Parses a CPU (or node) list like "0-3,8,10-11" */
+inline std::vector<int> parse_cpu_list (const char * s)
+{
+    std::vector<int> cpus;
+    while (*s >= '0' && *s <= '9') {
+        char * end;
+        int first = (int) strtol (s, &end, 10);
+        int last = first;
+        if (*end == '-') last = (int) strtol (end + 1, &end, 10);
+        for (int i = first; i <= last; i++) cpus.push_back (i);
+        s = *end == ',' ? end + 1 : end;
+    }
+    return cpus;
+}
+
+/** @return the numbers of the online NUMA nodes, which may have gaps (such as 0 and 2 with node 1 offline);
+  *         just node 0 if the topology is not available
+  */
+inline std::vector<int> numa_nodes ()
+{
+    std::vector<int> nodes;
+    FILE * f = fopen ("/sys/devices/system/node/online", "r");
+    if (f) {
+        char buf [1024];
+        if (fgets (buf, sizeof (buf), f)) nodes = parse_cpu_list (buf);
+        fclose (f);
+    }
+    if (nodes.empty ()) nodes.push_back (0);
+    return nodes;
+}
+
+/** @return the CPUs of the node; all the CPUs the process may run on if the topology is not available */
+inline std::vector<int> numa_node_cpus (int node)
+{
+    char path [96];
+    snprintf (path, sizeof (path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE * f = fopen (path, "r");
+    if (f) {
+        char buf [1024];
+        std::vector<int> cpus;
+        if (fgets (buf, sizeof (buf), f)) cpus = parse_cpu_list (buf);
+        fclose (f);
+        if (! cpus.empty ()) return cpus;
+    }
+    std::vector<int> cpus;
+    cpu_set_t set;
+    if (sched_getaffinity (0, sizeof (set), &set) == 0) {
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET (i, &set)) cpus.push_back (i);
+        }
+    }
+    return cpus;
+}
+
+/** @return the node of a device, such as "/sys/class/net/eth0/device", or -1 if it is not known */
+inline int device_numa_node (const std::string & device)
+{
+    FILE * f = fopen ((device + "/numa_node").c_str (), "r");
+    if (! f) return -1;
+    int node = -1;
+    if (fscanf (f, "%d", &node) != 1) node = -1;
+    fclose (f);
+    return node;
+}
+
+/** Restricts the calling thread to the given CPUs
+  * @return false if it was not possible
+  */
+inline bool pin_thread (const std::vector<int> & cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    for (size_t i = 0; i < cpus.size (); i++) {
+        CPU_SET (cpus [i], &set);
+    }
+    return pthread_setaffinity_np (pthread_self (), sizeof (set), &set) == 0;
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstring>
+#include <stdint.h>
+
+#include <cpuid.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/** Hardware performance counters of the calling thread (Linux perf_event_open), counted in user mode only.
+  * Every counter is opened on its own, so the ones not supported by the CPU, the kernel or the permissions
+  * (see /proc/sys/kernel/perf_event_paranoid) are simply missing. When there are more counters than the PMU
+  * can count at once, the kernel multiplexes them, and the values are scaled by the time each one was running.
+  * The store forwarding and shuffle port counters are raw Intel events (LD_BLOCKS.STORE_FORWARD and
+  * UOPS_DISPATCHED_PORT.PORT_5). Their encodings are only valid from Haswell to Skylake and its derivatives
+  * (Kaby Lake, Coffee Lake, Cascade Lake and so on), so they are opened only if cpuid reports one of these models;
+  * on other CPUs, including other Intel generations, these two counters are missing.
+  */
+class Perf_Counters
+{
+public:
+    enum Event { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, STORE_FORWARD_BLOCKS, SHUFFLE_PORT_UOPS, NUM_EVENTS };
+
+private:
+    int fds [NUM_EVENTS];
+    double values [NUM_EVENTS];
+
+    /** @return true if the CPU is an Intel one from Haswell to the Skylake derivatives */
+    static bool haswell_to_skylake ()
+    {
+        static const unsigned MODELS [] = {
+            0x3C, 0x3F, 0x45, 0x46,                 // Haswell
+            0x3D, 0x47, 0x4F, 0x56,                 // Broadwell
+            0x4E, 0x5E, 0x55,                       // Skylake, Skylake-SP (Cascade Lake, Cooper Lake)
+            0x8E, 0x9E, 0xA5, 0xA6                  // Kaby Lake, Coffee Lake, Comet Lake
+        };
+        unsigned eax, ebx, ecx, edx;
+        if (! __get_cpuid (0, &eax, &ebx, &ecx, &edx)) return false;
+        if (ebx != 0x756E6547 || edx != 0x49656E69 || ecx != 0x6C65746E) return false;     // "GenuineIntel"
+        if (! __get_cpuid (1, &eax, &ebx, &ecx, &edx)) return false;
+        unsigned family = eax >> 8 & 0xF;
+        unsigned model = (eax >> 4 & 0xF) | (eax >> 12 & 0xF0);
+        if (family != 6) return false;
+        for (unsigned m : MODELS) {
+            if (m == model) return true;
+        }
+        return false;
+    }
+
+    static int open_event (uint32_t type, uint64_t config)
+    {
+        perf_event_attr attr;
+        memset (&attr, 0, sizeof (attr));
+        attr.size = sizeof (attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return (int) syscall (__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    static uint64_t cache_miss (uint64_t cache)
+    {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+
+public:
+    Perf_Counters ()
+    {
+        fds [CYCLES] = open_event (PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        fds [INSTRUCTIONS] = open_event (PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        fds [L1D_MISSES] = open_event (PERF_TYPE_HW_CACHE, cache_miss (PERF_COUNT_HW_CACHE_L1D));
+        fds [LLC_MISSES] = open_event (PERF_TYPE_HW_CACHE, cache_miss (PERF_COUNT_HW_CACHE_LL));
+        bool raw = haswell_to_skylake ();
+        fds [STORE_FORWARD_BLOCKS] = raw ? open_event (PERF_TYPE_RAW, 0x0203) : -1;
+        fds [SHUFFLE_PORT_UOPS] = raw ? open_event (PERF_TYPE_RAW, 0x20A1) : -1;
+        for (int i = 0; i < NUM_EVENTS; i++) {
+            values [i] = 0;
+        }
+    }
+
+    ~Perf_Counters ()
+    {
+        for (int i = 0; i < NUM_EVENTS; i++) {
+            if (fds [i] >= 0) close (fds [i]);
+        }
+    }
+
+    /** @return true if at least one counter could be opened */
+    bool available () const
+    {
+        for (int i = 0; i < NUM_EVENTS; i++) {
+            if (fds [i] >= 0) return true;
+        }
+        return false;
+    }
+
+    bool available (Event e) const
+    {
+        return fds [e] >= 0;
+    }
+
+    void start ()
+    {
+        for (int i = 0; i < NUM_EVENTS; i++) {
+            if (fds [i] >= 0) {
+                ioctl (fds [i], PERF_EVENT_IOC_RESET, 0);
+                ioctl (fds [i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+
+    /** Stops counting and reads the values, which are then available from value () */
+    void stop ()
+    {
+        for (int i = 0; i < NUM_EVENTS; i++) {
+            if (fds [i] >= 0) ioctl (fds [i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+        for (int i = 0; i < NUM_EVENTS; i++) {
+            uint64_t data [3];  // value, time enabled, time running
+            values [i] = 0;
+            if (fds [i] >= 0 && read (fds [i], data, sizeof (data)) == sizeof (data) && data [2] != 0) {
+                values [i] = (double) data [0] * data [1] / data [2];
+            }
+        }
+    }
+
+    /** @return the value of the counter between the last start () and stop () */
+    double value (Event e) const
+    {
+        return values [e];
+    }
+};
+
+#endif
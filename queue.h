@@ -0,0 +1,39 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/** A blocking FIFO queue for passing buffers between pipeline stages.
+  * The pipelines use a fixed number of pre-allocated buffers that circulate between a "free" and a "full" queue,
+  * so the size of each queue is bounded by the number of buffers, and a stage that runs ahead blocks
+  * in pop() on the free queue.
+  */
+template<typename T> class Buffer_Queue
+{
+    std::mutex lock;
+    std::condition_variable not_empty;
+    std::deque<T> items;
+
+public:
+    void push (T x)
+    {
+        {
+            std::lock_guard<std::mutex> guard (lock);
+            items.push_back (x);
+        }
+        not_empty.notify_one ();
+    }
+
+    T pop ()
+    {
+        std::unique_lock<std::mutex> guard (lock);
+        while (items.empty ()) not_empty.wait (guard);
+        T x = items.front ();
+        items.pop_front ();
+        return x;
+    }
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef RING_H
+#define RING_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <xmmintrin.h>
+
+/** A set of single-producer single-consumer byte ring buffers, one per channel, that are filled together.
+  * The producer (the demultiplexer) writes the same number of bytes into every channel, so all the channels
+  * share one write index, and a whole block is published for all of them by one release store.
+  * Every channel has its own read index, so channels can be consumed by different threads at their own pace.
+  * All the indices live in separate cache lines.
+  * The capacity is a power of two and a multiple of the block size, so a block never wraps around the end of
+  * a buffer, and the demultiplexer can write into the buffers directly.
+  * The indices are never wrapped; the position in a buffer is the index modulo the capacity.
+  */
+class Ring_Set
+{
+    static const size_t CACHE_LINE = 64;
+
+    struct Index
+    {
+        std::atomic<size_t> pos;
+        char pad [CACHE_LINE - sizeof (std::atomic<size_t>)];
+    };
+
+    const size_t channels;
+    const size_t capacity;
+    const size_t block;
+    unsigned char ** buffers;
+    Index * head;           // written by the producer
+    Index * tails;          // tails [i] is written by the consumer of channel i
+    size_t cached_limit;    // producer only: the head may advance up to here without reading the tails
+
+public:
+    /** Creates a ring set
+      * @param channels  number of channels
+      * @param capacity  size of each channel buffer, a power of two and a multiple of block
+      * @param block     number of bytes written into every channel at once
+      */
+    Ring_Set (size_t channels, size_t capacity, size_t block)
+        : channels (channels), capacity (capacity), block (block), cached_limit (capacity)
+    {
+        assert ((capacity & (capacity - 1)) == 0);
+        assert (capacity % block == 0);
+
+        buffers = new unsigned char * [channels];
+        for (size_t i = 0; i < channels; i++) {
+            buffers [i] = (unsigned char *) _mm_malloc (capacity, CACHE_LINE);
+        }
+        head = new (_mm_malloc (sizeof (Index), CACHE_LINE)) Index;
+        head->pos.store (0, std::memory_order_relaxed);
+        tails = (Index *) _mm_malloc (sizeof (Index) * channels, CACHE_LINE);
+        for (size_t i = 0; i < channels; i++) {
+            new (&tails [i]) Index;
+            tails [i].pos.store (0, std::memory_order_relaxed);
+        }
+    }
+
+    ~Ring_Set ()
+    {
+        for (size_t i = 0; i < channels; i++) {
+            _mm_free (buffers [i]);
+        }
+        delete[] buffers;
+        _mm_free (head);
+        _mm_free (tails);
+    }
+
+    Ring_Set (const Ring_Set &) = delete;
+    Ring_Set & operator = (const Ring_Set &) = delete;
+
+    // ------- producer side
+
+    /** Provides the places to write the next block to
+      * @param dst  array of channels pointers, filled with the write positions
+      * @return false if some channel does not have space for a block
+      */
+    bool acquire (unsigned char ** dst)
+    {
+        size_t h = head->pos.load (std::memory_order_relaxed);
+        if (h + block > cached_limit) {
+            size_t min_tail = h;
+            for (size_t i = 0; i < channels; i++) {
+                size_t t = tails [i].pos.load (std::memory_order_acquire);
+                if (t < min_tail) min_tail = t;
+            }
+            cached_limit = min_tail + capacity;
+            if (h + block > cached_limit) return false;
+        }
+        size_t pos = h & (capacity - 1);
+        for (size_t i = 0; i < channels; i++) {
+            dst [i] = buffers [i] + pos;
+        }
+        return true;
+    }
+
+    /** Makes the block written into the places provided by acquire() visible to all consumers */
+    void publish ()
+    {
+        head->pos.store (head->pos.load (std::memory_order_relaxed) + block, std::memory_order_release);
+    }
+
+    // ------- consumer side
+
+    /** Provides the data available in the channel as one contiguous piece
+      * @param channel  channel number
+      * @param length   set to the number of bytes available
+      * @return pointer to the data (valid until release() is called)
+      */
+    const unsigned char * peek (size_t channel, size_t & length) const
+    {
+        size_t t = tails [channel].pos.load (std::memory_order_relaxed);
+        size_t h = head->pos.load (std::memory_order_acquire);
+        size_t pos = t & (capacity - 1);
+        length = h - t;
+        if (length > capacity - pos) length = capacity - pos;
+        return buffers [channel] + pos;
+    }
+
+    /** Returns the bytes obtained by peek() to the producer
+      * @param channel  channel number
+      * @param length   number of bytes consumed
+      */
+    void release (size_t channel, size_t length)
+    {
+        tails [channel].pos.store (tails [channel].pos.load (std::memory_order_relaxed) + length, std::memory_order_release);
+    }
+};
+
+#endif
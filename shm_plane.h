@@ -0,0 +1,197 @@
+#ifndef SHM_PLANE_H
+#define SHM_PLANE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** A ring of demultiplexed blocks in POSIX shared memory, written by one process and read by any number of others.
+  * Each slot holds one block in channel-major order (channel i at offset i * stride) and the sequence number
+  * of the block stored in it. The writer never waits for the readers: it overwrites the oldest slot.
+  * A reader that falls behind by more than the number of slots sees it from head(); a reader that is overtaken
+  * while it is processing a slot in place sees it from valid(), which re-checks the slot's sequence number
+  * (the seqlock scheme). So the readers never copy the data and never block the writer.
+  * The layout is: the header (two cache lines), then the slots, each starting with a cache line for its sequence number.
+  */
+class Shm_Plane
+{
+    static const uint32_t MAGIC = 0x45314450;   // "E1DP"
+    static const uint64_t WRITING = ~(uint64_t) 0;
+    static const size_t CACHE_LINE = 64;
+
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t channels;
+        uint64_t channel_size;
+        uint64_t stride;
+        uint64_t slots;
+        uint64_t slot_size;
+        alignas (CACHE_LINE) std::atomic<uint64_t> head;   // number of blocks published
+        std::atomic<uint32_t> closed;
+    };
+
+    struct Slot
+    {
+        alignas (CACHE_LINE) std::atomic<uint64_t> seq;
+    };
+
+    Header * header;
+    size_t map_size;
+
+    Shm_Plane (Header * header, size_t map_size) : header (header), map_size (map_size) {}
+
+    Slot * slot (uint64_t seq) const
+    {
+        return (Slot *) ((char *) header + sizeof (Header) + (seq % header->slots) * header->slot_size);
+    }
+
+public:
+    ~Shm_Plane ()
+    {
+        munmap (header, map_size);
+    }
+
+    Shm_Plane (const Shm_Plane &) = delete;
+    Shm_Plane & operator = (const Shm_Plane &) = delete;
+
+    /** Creates a new plane, replacing any existing one with the same name
+      * @param name          shared memory object name, "/something"
+      * @param channels      number of channels in a block
+      * @param channel_size  number of bytes of each channel in a block
+      * @param slots         number of blocks kept
+      * @return the plane, or NULL if the shared memory could not be created (errno is set)
+      */
+    static Shm_Plane * create (const char * name, size_t channels, size_t channel_size, size_t slots)
+    {
+        size_t stride = (channel_size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+        size_t slot_size = sizeof (Slot) + stride * channels;
+        size_t map_size = sizeof (Header) + slot_size * slots;
+
+        shm_unlink (name);
+        int fd = shm_open (name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) return NULL;
+        if (ftruncate (fd, map_size) != 0) {
+            ::close (fd);
+            return NULL;
+        }
+        void * p = mmap (NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close (fd);
+        if (p == MAP_FAILED) return NULL;
+
+        Header * h = new (p) Header;
+        h->channels = (uint32_t) channels;
+        h->channel_size = channel_size;
+        h->stride = stride;
+        h->slots = slots;
+        h->slot_size = slot_size;
+        h->head.store (0, std::memory_order_relaxed);
+        h->closed.store (0, std::memory_order_relaxed);
+        Shm_Plane * plane = new Shm_Plane (h, map_size);
+        for (uint64_t i = 0; i < slots; i++) {
+            new (plane->slot (i)) Slot;
+            plane->slot (i)->seq.store (WRITING, std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence (std::memory_order_release);
+        h->magic = MAGIC;
+        return plane;
+    }
+
+    /** Opens a plane created by another process
+      * @return the plane, or NULL if it does not exist or is not a plane
+      */
+    static Shm_Plane * open (const char * name)
+    {
+        int fd = shm_open (name, O_RDWR, 0);
+        if (fd < 0) return NULL;
+        struct stat st;
+        if (fstat (fd, &st) != 0 || (size_t) st.st_size < sizeof (Header)) {
+            ::close (fd);
+            return NULL;
+        }
+        void * p = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close (fd);
+        if (p == MAP_FAILED) return NULL;
+        Header * h = (Header *) p;
+        if (h->magic != MAGIC || sizeof (Header) + h->slot_size * h->slots > (size_t) st.st_size) {
+            munmap (p, st.st_size);
+            return NULL;
+        }
+        return new Shm_Plane (h, st.st_size);
+    }
+
+    /** Removes the shared memory object name; the processes that have it mapped keep working */
+    static void remove (const char * name)
+    {
+        shm_unlink (name);
+    }
+
+    size_t channels () const { return header->channels; }
+    size_t channel_size () const { return header->channel_size; }
+    uint64_t slots () const { return header->slots; }
+
+    // ------- writer side
+
+    /** Provides the places to write the next block to, invalidating the oldest block
+      * @param dst  array of channel pointers, filled with the write positions (aligned to 64 bytes)
+      */
+    void acquire (unsigned char ** dst)
+    {
+        uint64_t seq = header->head.load (std::memory_order_relaxed);
+        Slot * s = slot (seq);
+        s->seq.store (WRITING, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_release);
+        for (size_t i = 0; i < header->channels; i++) {
+            dst [i] = (unsigned char *) s + sizeof (Slot) + i * header->stride;
+        }
+    }
+
+    /** Publishes the block written into the places provided by acquire() */
+    void publish ()
+    {
+        uint64_t seq = header->head.load (std::memory_order_relaxed);
+        slot (seq)->seq.store (seq, std::memory_order_release);
+        header->head.store (seq + 1, std::memory_order_release);
+    }
+
+    /** Tells the readers that no more blocks will be published */
+    void close ()
+    {
+        header->closed.store (1, std::memory_order_release);
+    }
+
+    // ------- reader side
+
+    /** @return the number of blocks published so far; the blocks from head() - slots() up are available */
+    uint64_t head () const
+    {
+        return header->head.load (std::memory_order_acquire);
+    }
+
+    bool closed () const
+    {
+        return header->closed.load (std::memory_order_acquire) != 0;
+    }
+
+    /** @return the data of a channel in a block; check valid() after using it */
+    const unsigned char * channel (uint64_t seq, size_t i) const
+    {
+        return (const unsigned char *) slot (seq) + sizeof (Slot) + i * header->stride;
+    }
+
+    /** @return true if the block is still in its slot, so everything read from it so far is consistent */
+    bool valid (uint64_t seq) const
+    {
+        std::atomic_thread_fence (std::memory_order_acquire);
+        return slot (seq)->seq.load (std::memory_order_relaxed) == seq;
+    }
+};
+
+#endif
@@ -5,12 +5,16 @@
 #include <emmintrin.h>
 #include <immintrin.h>
 
+#include "unroll.h"
+
 /** Many functions here are defined as macros. The reason for this is that the SSE/AVX shuffle/permute instructions
   * require compile-time constant arguments, and there is no way to provide such requirements in C
   * (or, rather, I don't know of such a way; perhaps, something is possible with templates)
   * Even if the function is inline and is called with constant arguments, compiler still complains when this
   * function calls intrinsics with its parameters. Macros help work it around, however we pay for it with
   * lack of type checking
+  * Some newer functions use templates instead: shuffle masks are computed by constexpr functions
+  * (transpose_mask), and unrolling is done with unroll<N> from unroll.h.
   */
 
 // ------- loads and stores
@@ -35,6 +39,8 @@ inline void _128i_store (unsigned char * p, __m128i x)
     _mm_store_si128 ((__m128i *) p, x);
 }
 
+#ifdef __AVX2__
+
 /** Store 256-bit integer value to the unsigned char pointer
   * @param p  a pointer to write 256 bits to
   * @param x  a 256-bit integer value to write
@@ -45,6 +51,8 @@ inline void _256i_store (unsigned char * p, __m256i x)
     _mm256_store_si256 ( (__m256i *) p, x);
 }
 
+#endif
+
 /** Combine together two fields of 4 bits each, in lower to high order.
   * Used in permute2f128
   * @param n0 constant integer value of size 4 bits (not checked)
@@ -63,6 +71,28 @@ inline void _256i_store (unsigned char * p, __m256i x)
   */
 #define combine_4_2bits(n0, n1, n2, n3) (n0 + (n1<<2) + (n2<<4) + (n3<<6))
 
+/** Byte i of the PSHUFB mask that transposes a rows x cols byte matrix stored by rows (rows * cols == 16).
+  * Byte i of the result is row i % rows, column i / rows of the source.
+  */
+constexpr char transpose_mask_byte (size_t i, size_t rows, size_t cols)
+{
+    return (char) ((i % rows) * cols + i / rows);
+}
+
+template<size_t ROWS, size_t COLS, size_t... I> ALWAYS_INLINE __m128i transpose_mask (std::index_sequence<I...>)
+{
+    static_assert (ROWS * COLS == 16, "the matrix must fill the register");
+    return _mm_setr_epi8 (transpose_mask_byte (I, ROWS, COLS)...);
+}
+
+/** The PSHUFB mask that transposes a ROWS x COLS byte matrix stored by rows in a 128-bit register;
+  * transpose_mask<4, 4> () is the mask used in transpose_4x4.
+  */
+template<size_t ROWS, size_t COLS> ALWAYS_INLINE __m128i transpose_mask ()
+{
+    return transpose_mask<ROWS, COLS> (std::make_index_sequence<16> ());
+}
+
 // ------ General shuffles and permutations
 
 /** shuffles two 128-bit registers according to four 2-bit constants defining positions.
@@ -109,6 +139,8 @@ inline void _256i_store (unsigned char * p, __m256i x)
   */
 #define _256i_shuffle(x, y, n0, n1, n2, n3) _mm256_castps_si256 (_256_shuffle (_mm256_castsi256_ps (x), _mm256_castsi256_ps (y), n0, n1, n2, n3))
 
+#ifdef __AVX2__
+
 /** Combine two 128-bit values (4 dwords each) into one 256-bit value (8 dwords)
   * @param lo ABCD     (each element is a dword)
   * @param hi EFGH     (each element is a dword)
@@ -122,6 +154,8 @@ inline __m256i _256i_combine_lo_hi (__m128i lo, __m128i hi)
     return a;
 }
 
+#endif
+
 // ------ More specific permutations
 
 /** transposes a 4x4 byte matrix stored in a 128-bit register
@@ -138,9 +172,20 @@ inline __m256i _256i_combine_lo_hi (__m128i lo, __m128i hi)
   */
 inline __m128i transpose_4x4 (__m128i m)
 {
-    return _mm_shuffle_epi8 (m, _mm_setr_epi8 (0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15));
+    return _mm_shuffle_epi8 (m, transpose_mask<4, 4> ());
 }
 
+#ifdef __AVX2__
+
+/** transposes a 4x4 byte matrix in each 128-bit half of a 256-bit register (see transpose_4x4 (__m128i))
+  */
+inline __m256i transpose_4x4 (__m256i m)
+{
+    return _mm256_shuffle_epi8 (m, _mm256_broadcastsi128_si256 (transpose_mask<4, 4> ()));
+}
+
+#endif
+
 /** Combines together 4-byte portions of the four given 128-bit registers
   * @param i  position of portions to combine (a constant)
   * @param m0  m00 m01 m02 m03
@@ -216,6 +261,8 @@ inline void transpose_4x4_dwords (__m128i w0, __m128i w1, __m128i w2, __m128i w3
     r3 = _128i_shuffle (x1, x3, 1, 3, 1, 3);
 }
 
+#ifdef __AVX2__
+
 inline void transpose_avx_4x4_dwords (__m256i &w0, __m256i &w1, __m256i &w2, __m256i &w3)
 {
     // 0  1  2  3
@@ -233,3 +280,201 @@ inline void transpose_avx_4x4_dwords (__m256i &w0, __m256i &w1, __m256i &w2, __m
     w2 = _256i_shuffle (x1, x3, 0, 2, 0, 2);
     w3 = _256i_shuffle (x1, x3, 1, 3, 1, 3);
 }
+
+/** transposes a 4x4 matrix of doublewords in each 128-bit half of four 256-bit registers, returning result in four other registers
+  * (see the __m128i version)
+  */
+inline void transpose_4x4_dwords (__m256i w0, __m256i w1, __m256i w2, __m256i w3, __m256i &r0, __m256i &r1, __m256i &r2, __m256i &r3)
+{
+    __m256i x0 = _256i_shuffle (w0, w1, 0, 1, 0, 1); // 0 1 4 5
+    __m256i x1 = _256i_shuffle (w0, w1, 2, 3, 2, 3); // 2 3 6 7
+    __m256i x2 = _256i_shuffle (w2, w3, 0, 1, 0, 1); // 8 9 12 13
+    __m256i x3 = _256i_shuffle (w2, w3, 2, 3, 2, 3); // 10 11 14 15
+
+    r0 = _256i_shuffle (x0, x2, 0, 2, 0, 2);
+    r1 = _256i_shuffle (x0, x2, 1, 3, 1, 3);
+    r2 = _256i_shuffle (x1, x3, 0, 2, 0, 2);
+    r3 = _256i_shuffle (x1, x3, 1, 3, 1, 3);
+}
+
+#endif
+
+// ------ Templates
+
+/** transposes a 16x16 byte matrix stored in 16 registers, one row per register. For 256-bit registers, two
+  * matrices are transposed independently, one in each 128-bit half.
+  * The same source serves both register widths, because transpose_4x4_dwords and transpose_4x4 are overloaded on them.
+  * Input:  x [i] byte j = m [i][j]
+  * Output: x [i] byte j = m [j][i]
+  */
+template<class V> ALWAYS_INLINE void transpose_16x16 (V (&x) [16])
+{
+    V m [16];
+    unroll<4> ([&] (auto g) ALWAYS_INLINE_LAMBDA {
+        transpose_4x4_dwords (x [4 * g], x [4 * g + 1], x [4 * g + 2], x [4 * g + 3],
+                              m [4 * g], m [4 * g + 1], m [4 * g + 2], m [4 * g + 3]);
+    });
+    unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA {
+        m [i] = transpose_4x4 (m [i]);
+    });
+    unroll<4> ([&] (auto k) ALWAYS_INLINE_LAMBDA {
+        transpose_4x4_dwords (m [k], m [4 + k], m [8 + k], m [12 + k],
+                              x [4 * k], x [4 * k + 1], x [4 * k + 2], x [4 * k + 3]);
+    });
+}
+
+/** Unpacks the low halves of two registers, interleaving elements of 1, 2, 4 or 8 bytes (LEVEL 0 .. 3):
+  * PUNPCKLBW, PUNPCKLWD, PUNPCKLDQ, PUNPCKLQDQ
+  */
+template<size_t LEVEL> ALWAYS_INLINE __m128i unpack_lo (__m128i a, __m128i b)
+{
+    return LEVEL == 0 ? _mm_unpacklo_epi8 (a, b)
+         : LEVEL == 1 ? _mm_unpacklo_epi16 (a, b)
+         : LEVEL == 2 ? _mm_unpacklo_epi32 (a, b)
+         :              _mm_unpacklo_epi64 (a, b);
+}
+
+template<size_t LEVEL> ALWAYS_INLINE __m128i unpack_hi (__m128i a, __m128i b)
+{
+    return LEVEL == 0 ? _mm_unpackhi_epi8 (a, b)
+         : LEVEL == 1 ? _mm_unpackhi_epi16 (a, b)
+         : LEVEL == 2 ? _mm_unpackhi_epi32 (a, b)
+         :              _mm_unpackhi_epi64 (a, b);
+}
+
+#ifdef __AVX2__
+
+/** 256-bit versions of unpack_lo and unpack_hi, working in each 128-bit half */
+template<size_t LEVEL> ALWAYS_INLINE __m256i unpack_lo (__m256i a, __m256i b)
+{
+    return LEVEL == 0 ? _mm256_unpacklo_epi8 (a, b)
+         : LEVEL == 1 ? _mm256_unpacklo_epi16 (a, b)
+         : LEVEL == 2 ? _mm256_unpacklo_epi32 (a, b)
+         :              _mm256_unpacklo_epi64 (a, b);
+}
+
+template<size_t LEVEL> ALWAYS_INLINE __m256i unpack_hi (__m256i a, __m256i b)
+{
+    return LEVEL == 0 ? _mm256_unpackhi_epi8 (a, b)
+         : LEVEL == 1 ? _mm256_unpackhi_epi16 (a, b)
+         : LEVEL == 2 ? _mm256_unpackhi_epi32 (a, b)
+         :              _mm256_unpackhi_epi64 (a, b);
+}
+
+#endif
+
+constexpr size_t bit_reverse_4 (size_t i)
+{
+    return ((i & 1) << 3) | ((i & 2) << 1) | ((i & 4) >> 1) | ((i & 8) >> 3);
+}
+
+/** one level of transpose_16x16_unpack: interleaves rows 2k and 2k+1 in elements of 1 << LEVEL bytes,
+  * putting the low halves into row k and the high halves into row 8 + k
+  */
+template<size_t LEVEL, class V> ALWAYS_INLINE void unpack_level (V (&x) [16])
+{
+    V y [16];
+    unroll<8> ([&] (auto k) ALWAYS_INLINE_LAMBDA {
+        y [k] = unpack_lo<LEVEL> (x [2 * k], x [2 * k + 1]);
+        y [8 + k] = unpack_hi<LEVEL> (x [2 * k], x [2 * k + 1]);
+    });
+    unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA { x [i] = y [i]; });
+}
+
+/** transposes a 16x16 byte matrix like transpose_16x16, with the unpack cascade (bytes, words, dwords, qwords)
+  * instead of PSHUFB and SHUFPS. It needs only SSE2, and on some cores unpacks can go to more than one port.
+  * After the four levels, column c of the source is in register bit_reverse_4 (c).
+  */
+template<class V> ALWAYS_INLINE void transpose_16x16_unpack (V (&x) [16])
+{
+    unpack_level<0> (x);
+    unpack_level<1> (x);
+    unpack_level<2> (x);
+    unpack_level<3> (x);
+    V y [16];
+    unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA { y [i] = x [bit_reverse_4 (i)]; });
+    unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA { x [i] = y [i]; });
+}
+
+/** reverses the order of bits in every byte (for framers that deliver the timeslots LSB first):
+  * PSHUFB looks up the reversed low nibble, which becomes the high one, and the reversed high nibble,
+  * which becomes the low one.
+  */
+inline __m128i reverse_bits (__m128i x)
+{
+    const __m128i rev_lo = _mm_setr_epi8 (0x00, 0x80, 0x40, 0xC0, 0x20, 0xA0, 0x60, 0xE0,
+                                          0x10, 0x90, 0x50, 0xD0, 0x30, 0xB0, 0x70, 0xF0);
+    const __m128i rev_hi = _mm_setr_epi8 (0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE,
+                                          0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF);
+    const __m128i nibble = _mm_set1_epi8 (0x0F);
+    return _mm_or_si128 (_mm_shuffle_epi8 (rev_lo, _mm_and_si128 (x, nibble)),
+                         _mm_shuffle_epi8 (rev_hi, _mm_and_si128 (_mm_srli_epi16 (x, 4), nibble)));
+}
+
+#ifdef __AVX2__
+
+inline __m256i reverse_bits (__m256i x)
+{
+    const __m256i rev_lo = _mm256_broadcastsi128_si256 (_mm_setr_epi8 (0x00, 0x80, 0x40, 0xC0, 0x20, 0xA0, 0x60, 0xE0,
+                                                                       0x10, 0x90, 0x50, 0xD0, 0x30, 0xB0, 0x70, 0xF0));
+    const __m256i rev_hi = _mm256_broadcastsi128_si256 (_mm_setr_epi8 (0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE,
+                                                                       0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF));
+    const __m256i nibble = _mm256_set1_epi8 (0x0F);
+    return _mm256_or_si256 (_mm256_shuffle_epi8 (rev_lo, _mm256_and_si256 (x, nibble)),
+                            _mm256_shuffle_epi8 (rev_hi, _mm256_and_si256 (_mm256_srli_epi16 (x, 4), nibble)));
+}
+
+#endif
+
+// ------ Byte and word arithmetic, overloaded for 128- and 256-bit registers (for templates that work with both)
+
+template<class V> V load_vector (const unsigned char * p);
+template<class V> V set_bytes (unsigned char b);
+
+template<> inline __m128i load_vector<__m128i> (const unsigned char * p) { return _128i_load (p); }
+template<> inline __m128i set_bytes<__m128i> (unsigned char b) { return _mm_set1_epi8 ((char) b); }
+
+inline __m128i or_bits (__m128i a, __m128i b) { return _mm_or_si128 (a, b); }
+inline __m128i xor_bits (__m128i a, __m128i b) { return _mm_xor_si128 (a, b); }
+inline __m128i and_bits (__m128i a, __m128i b) { return _mm_and_si128 (a, b); }
+inline __m128i add_bytes (__m128i a, __m128i b) { return _mm_add_epi8 (a, b); }
+inline __m128i add_words (__m128i a, __m128i b) { return _mm_add_epi16 (a, b); }
+inline __m128i high_bytes (__m128i a) { return _mm_srli_epi16 (a, 8); }
+
+/** @return d | (a ^ b), in one instruction (VPTERNLOGQ) if AVX-512VL is available */
+inline __m128i or_xor (__m128i d, __m128i a, __m128i b)
+{
+#ifdef __AVX512VL__
+    return _mm_ternarylogic_epi64 (d, a, b, 0xF6);
+#else
+    return _mm_or_si128 (d, _mm_xor_si128 (a, b));
+#endif
+}
+
+/** @return a mask with bit i set if byte i of x is zero */
+inline unsigned zero_bytes (__m128i x) { return (unsigned) _mm_movemask_epi8 (_mm_cmpeq_epi8 (x, _mm_setzero_si128 ())); }
+
+#ifdef __AVX2__
+
+template<> inline __m256i load_vector<__m256i> (const unsigned char * p) { return _mm256_load_si256 ((const __m256i *) p); }
+template<> inline __m256i set_bytes<__m256i> (unsigned char b) { return _mm256_set1_epi8 ((char) b); }
+
+inline __m256i or_bits (__m256i a, __m256i b) { return _mm256_or_si256 (a, b); }
+inline __m256i xor_bits (__m256i a, __m256i b) { return _mm256_xor_si256 (a, b); }
+inline __m256i and_bits (__m256i a, __m256i b) { return _mm256_and_si256 (a, b); }
+inline __m256i add_bytes (__m256i a, __m256i b) { return _mm256_add_epi8 (a, b); }
+inline __m256i add_words (__m256i a, __m256i b) { return _mm256_add_epi16 (a, b); }
+inline __m256i high_bytes (__m256i a) { return _mm256_srli_epi16 (a, 8); }
+
+inline __m256i or_xor (__m256i d, __m256i a, __m256i b)
+{
+#ifdef __AVX512VL__
+    return _mm256_ternarylogic_epi64 (d, a, b, 0xF6);
+#else
+    return _mm256_or_si256 (d, _mm256_xor_si256 (a, b));
+#endif
+}
+
+inline unsigned zero_bytes (__m256i x) { return (unsigned) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (x, _mm256_setzero_si256 ())); }
+
+#endif
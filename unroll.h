@@ -0,0 +1,35 @@
+#ifndef UNROLL_H
+#define UNROLL_H
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+/** Forces inlining. The transposition helpers are big enough for the compiler to decide not to inline them,
+  * and then everything that was meant to stay in registers goes through memory.
+  */
+#define ALWAYS_INLINE inline __attribute__ ((always_inline))
+
+/** The same for lambdas, placed after the parameter list: [&] (auto i) ALWAYS_INLINE_LAMBDA { ... }.
+  * unroll<N> cannot force inlining of the lambda it is given, and a lambda that moves a register block
+  * is big enough for the compiler to call it instead.
+  */
+#define ALWAYS_INLINE_LAMBDA __attribute__ ((always_inline))
+
+template<class F, size_t... I> ALWAYS_INLINE void unroll (F && f, std::index_sequence<I...>)
+{
+    int dummy [] = {0, (f (std::integral_constant<size_t, I> ()), 0)...};
+    (void) dummy;
+}
+
+/** A template replacement for the DUP_N macros from mymacros.h:
+  * unroll<4> (f) is expanded as f(0); f(1); f(2); f(3), where the arguments are std::integral_constant,
+  * so they can be used as template arguments and as compile-time constants inside f.
+  * f is usually a generic lambda: unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA { w [i] = load (src + i * stride); });
+  */
+template<size_t N, class F> ALWAYS_INLINE void unroll (F && f)
+{
+    unroll (f, std::make_index_sequence<N> ());
+}
+
+#endif
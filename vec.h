@@ -0,0 +1,174 @@
+#ifndef VEC_H
+#define VEC_H
+
+#include <cstddef>
+#include <cstring>
+#include <utility>
+
+#include "unroll.h"
+
+/** Transpositions written with the GCC/Clang vector extensions instead of the x86 intrinsics of sse.h.
+  * Shuffles are __builtin_shufflevector with index lists generated from index_sequence, so the constant
+  * arguments are not a problem here, and nothing in this file depends on the instruction set: the compiler picks
+  * PUNPCKL*, VPUNPCKL* or VPERM* for the target given with -m (SSE2, AVX2, AVX-512BW), or splits the vectors
+  * into narrower ones if the target has no registers that wide.
+  * The unpacks work within 16-byte lanes, like the x86 ones, so they map to single instructions on all these targets.
+  */
+
+// Everything here is always inlined, so passing vec64 by value when it does not fit a register
+// (the ABI change GCC warns about) never happens.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+typedef unsigned char vec16 __attribute__ ((vector_size (16), may_alias));
+typedef unsigned char vec32 __attribute__ ((vector_size (32), may_alias));
+typedef unsigned char vec64 __attribute__ ((vector_size (64), may_alias));
+
+/** Loads a vector from an address aligned to the vector size */
+template<class V> ALWAYS_INLINE V vec_load (const unsigned char * p)
+{
+    return * (const V *) p;
+}
+
+template<class V> ALWAYS_INLINE void vec_store (unsigned char * p, V x)
+{
+    * (V *) p = x;
+}
+
+#if defined (__clang__) || __GNUC__ >= 12
+
+template<size_t... I> ALWAYS_INLINE vec64 vec_concat (vec32 a, vec32 b, std::index_sequence<I...>)
+{
+    return __builtin_shufflevector (a, b, I...);
+}
+
+template<size_t OFFSET, size_t... I> ALWAYS_INLINE vec32 vec_half (vec64 x, std::index_sequence<I...>)
+{
+    return __builtin_shufflevector (x, x, (OFFSET + I)...);
+}
+
+#endif
+
+/** Makes a vector of two 32-byte halves loaded from two addresses, aligned to 32 */
+ALWAYS_INLINE vec64 vec_load_halves (const unsigned char * lo, const unsigned char * hi)
+{
+#if defined (__clang__) || __GNUC__ >= 12
+    return vec_concat (vec_load<vec32> (lo), vec_load<vec32> (hi), std::make_index_sequence<64> ());
+#else
+    vec64 x;
+    memcpy (&x, lo, 32);
+    memcpy ((unsigned char *) &x + 32, hi, 32);
+    return x;
+#endif
+}
+
+ALWAYS_INLINE void vec_store_halves (unsigned char * lo, unsigned char * hi, vec64 x)
+{
+#if defined (__clang__) || __GNUC__ >= 12
+    vec_store (lo, vec_half<0> (x, std::make_index_sequence<32> ()));
+    vec_store (hi, vec_half<32> (x, std::make_index_sequence<32> ()));
+#else
+    memcpy (lo, &x, 32);
+    memcpy (hi, (const unsigned char *) &x + 32, 32);
+#endif
+}
+
+/** The source byte for byte i of an unpack of two vectors of the given size, in elements of 1 << level bytes:
+  * within each 16-byte lane, elements of the low (or high) halves of a and b are interleaved.
+  * Bytes of b are numbered from size.
+  */
+constexpr int unpack_index (size_t level, size_t size, bool high, size_t i)
+{
+    size_t lane = i / 16 * 16;
+    size_t e = (i % 16) >> level;                       // element of the result in the lane
+    size_t source = (e / 2 + (high ? 8 >> level : 0)) << level;
+    return (int) ((e % 2 ? size : 0) + lane + source + i % (1 << level));
+}
+
+/** The source byte for byte i of a concatenation of the halves of a and b (low halves or high halves) */
+constexpr int combine_index (size_t size, bool high, size_t i)
+{
+    return (int) ((i < size / 2 ? 0 : size) + (high ? size / 2 : 0) + i % (size / 2));
+}
+
+/** Unpacks the low (HIGH = false) or high halves of every 16-byte lane of two vectors,
+  * interleaving elements of 1, 2, 4 or 8 bytes (LEVEL 0 .. 3)
+  */
+template<size_t LEVEL, bool HIGH, class V, size_t... I> ALWAYS_INLINE V vec_unpack (V a, V b, std::index_sequence<I...>)
+{
+#if defined (__clang__) || __GNUC__ >= 12
+    return __builtin_shufflevector (a, b, unpack_index (LEVEL, sizeof (V), HIGH, I)...);
+#else
+    return __builtin_shuffle (a, b, V {(unsigned char) unpack_index (LEVEL, sizeof (V), HIGH, I)...});
+#endif
+}
+
+/** Concatenates the low (HIGH = false) or high halves of two vectors */
+template<bool HIGH, class V, size_t... I> ALWAYS_INLINE V vec_combine (V a, V b, std::index_sequence<I...>)
+{
+#if defined (__clang__) || __GNUC__ >= 12
+    return __builtin_shufflevector (a, b, combine_index (sizeof (V), HIGH, I)...);
+#else
+    return __builtin_shuffle (a, b, V {(unsigned char) combine_index (sizeof (V), HIGH, I)...});
+#endif
+}
+
+template<size_t LEVEL, bool HIGH, class V> ALWAYS_INLINE V vec_unpack (V a, V b)
+{
+    return vec_unpack<LEVEL, HIGH> (a, b, std::make_index_sequence<sizeof (V)> ());
+}
+
+template<bool HIGH, class V> ALWAYS_INLINE V vec_combine (V a, V b)
+{
+    return vec_combine<HIGH> (a, b, std::make_index_sequence<sizeof (V)> ());
+}
+
+/** The source byte for byte i of a swap of 16-byte lanes 1 and 2 */
+constexpr int swap_lanes_index (size_t i)
+{
+    return (int) ((i / 16 == 1 ? 32 : i / 16 == 2 ? 16 : i / 16 * 16) + i % 16);
+}
+
+template<size_t... I> ALWAYS_INLINE vec64 vec_swap_lanes (vec64 x, std::index_sequence<I...>)
+{
+#if defined (__clang__) || __GNUC__ >= 12
+    return __builtin_shufflevector (x, x, swap_lanes_index (I)...);
+#else
+    return __builtin_shuffle (x, vec64 {(unsigned char) swap_lanes_index (I)...});
+#endif
+}
+
+/** Swaps the middle 16-byte lanes: lanes 0, 1, 2, 3 become 0, 2, 1, 3 */
+ALWAYS_INLINE vec64 vec_swap_lanes (vec64 x)
+{
+    return vec_swap_lanes (x, std::make_index_sequence<64> ());
+}
+
+constexpr size_t vec_bit_reverse_4 (size_t i)
+{
+    return ((i & 1) << 3) | ((i & 2) << 1) | ((i & 4) >> 1) | ((i & 8) >> 3);
+}
+
+/** transposes 16x16 byte matrices stored in 16 vectors, one in every 16-byte lane, with the unpack cascade
+  * (bytes, words, dwords, qwords), in the same way as transpose_16x16_unpack from sse.h.
+  * Input:  x [i] byte 16 * l + j = m_l [i][j]
+  * Output: x [i] byte 16 * l + j = m_l [j][i]
+  */
+template<class V> ALWAYS_INLINE void vec_transpose_16x16 (V (&x) [16])
+{
+    unroll<4> ([&] (auto level) ALWAYS_INLINE_LAMBDA {
+        V y [16];
+        unroll<8> ([&] (auto k) ALWAYS_INLINE_LAMBDA {
+            y [k] = vec_unpack<level, false> (x [2 * k], x [2 * k + 1]);
+            y [8 + k] = vec_unpack<level, true> (x [2 * k], x [2 * k + 1]);
+        });
+        unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA { x [i] = y [i]; });
+    });
+    V y [16];
+    unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA { y [i] = x [vec_bit_reverse_4 (i)]; });
+    unroll<16> ([&] (auto i) ALWAYS_INLINE_LAMBDA { x [i] = y [i]; });
+}
+
+#pragma GCC diagnostic pop
+
+#endif